@@ -0,0 +1,44 @@
+#include "arena.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+AstArena::~AstArena() {
+  for (auto it{destructors.rbegin()}; it != destructors.rend(); ++it) {
+    it->first(it->second);
+  }
+}
+
+void *AstArena::allocate(size_t size, size_t align) {
+  auto address{reinterpret_cast<uintptr_t>(cursor)};
+  auto padding{(align - address % align) % align};
+  if (!cursor || padding + size > static_cast<size_t>(limit - cursor)) {
+    // Oversized requests get a block of their own
+    auto block_size{std::max(BLOCK_SIZE, size + align)};
+    blocks.push_back(std::make_unique_for_overwrite<std::byte[]>(block_size));
+    cursor = blocks.back().get();
+    limit = cursor + block_size;
+    address = reinterpret_cast<uintptr_t>(cursor);
+    padding = (align - address % align) % align;
+  }
+  auto *out{cursor + padding};
+  cursor = out + size;
+  used += size;
+  return out;
+}
+
+std::string_view AstArena::copy(std::string_view text) {
+  if (text.empty()) {
+    return {};
+  }
+  auto *out{static_cast<char *>(allocate(text.length(), 1))};
+  std::memcpy(out, text.data(), text.length());
+  return {out, text.length()};
+}
+
+void AstArena::retain(std::shared_ptr<const void> other) {
+  if (other.get() != this &&
+      std::find(retained.begin(), retained.end(), other) == retained.end()) {
+    retained.push_back(std::move(other));
+  }
+}
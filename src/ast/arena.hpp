@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator that owns the nodes of one parse. Nodes are never destroyed
+// one at a time: dropping the arena frees its blocks in one go. The few
+// objects that need a destructor have it run then, in reverse order.
+class AstArena : public std::enable_shared_from_this<AstArena> {
+public:
+  AstArena() = default;
+  AstArena(const AstArena &) = delete;
+  AstArena &operator=(const AstArena &) = delete;
+  ~AstArena();
+
+  template <typename T, typename... Args> T *make(Args &&...args) {
+    auto *out{new (allocate(sizeof(T), alignof(T)))
+                  T(std::forward<Args>(args)...)};
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      destructors.push_back(
+          {[](void *p) { static_cast<T *>(p)->~T(); }, out});
+    }
+    return out;
+  }
+  template <typename T> std::span<T> copy(const std::vector<T> &items) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "arena objects are freed without running destructors");
+    if (items.empty()) {
+      return {};
+    }
+    auto *out{static_cast<T *>(allocate(sizeof(T) * items.size(), alignof(T)))};
+    std::uninitialized_copy(items.begin(), items.end(), out);
+    return {out, items.size()};
+  }
+  std::string_view copy(std::string_view);
+  // Keeps `other` alive for as long as this arena, for nodes shared between
+  // programs and the tokens of lazily parsed function bodies
+  void retain(std::shared_ptr<const void> other);
+  size_t bytes_used() const { return used; }
+
+private:
+  static constexpr size_t BLOCK_SIZE{64 * 1024};
+  void *allocate(size_t size, size_t align);
+  std::vector<std::unique_ptr<std::byte[]>> blocks{};
+  std::byte *cursor{nullptr};
+  std::byte *limit{nullptr};
+  size_t used{0};
+  std::vector<std::shared_ptr<const void>> retained{};
+  std::vector<std::pair<void (*)(void *), void *>> destructors{};
+};
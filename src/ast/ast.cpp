@@ -2,6 +2,9 @@
 #include <sstream>
 
 // {{{ Program
+Program::Program() : Program(std::make_shared<AstArena>()) {}
+Program::Program(std::shared_ptr<AstArena> arena)
+    : Node(NodeKind::Program), arena(std::move(arena)) {}
 
 std::string Program::token_literal() const {
   std::stringstream ss;
@@ -21,19 +24,23 @@ std::string Program::to_string() const {
 // }}}
 
 // {{{ Identifier
-Identifier::Identifier(std::string v) : value(v) {}
+Identifier::Identifier(Symbol s)
+    : Expression(NodeKind::Identifier), symbol(s), value(symbol_name(s)) {}
+Identifier::Identifier(std::string_view v) : Identifier(intern(v)) {}
 std::string Identifier::token_literal() const { return "IDENT"; }
-std::string Identifier::to_string() const { return value; }
+std::string Identifier::to_string() const { return std::string{value}; }
 // }}}
 
 // {{{ IntegerLiteral
-IntegerLiteral::IntegerLiteral(IntType v) : value(v) {}
+IntegerLiteral::IntegerLiteral(IntType v)
+    : Expression(NodeKind::IntegerLiteral), value(v) {}
 std::string IntegerLiteral::token_literal() const { return "INT"; }
 std::string IntegerLiteral::to_string() const { return std::to_string(value); }
 // }}}
 
 // {{{ BooleanLiteral
-BooleanLiteral::BooleanLiteral(bool v) : value(v) {}
+BooleanLiteral::BooleanLiteral(bool v)
+    : Expression(NodeKind::BooleanLiteral), value(v) {}
 std::string BooleanLiteral::token_literal() const { return "BOOL"; }
 std::string BooleanLiteral::to_string() const {
   return value ? "true" : "false";
@@ -41,14 +48,15 @@ std::string BooleanLiteral::to_string() const {
 // }}}
 
 // {{{ StringLiteral
-StringLiteral::StringLiteral(const std::string &v) : value(v) {}
-std::string StringLiteral::token_literal() const { return value; }
-std::string StringLiteral::to_string() const { return value; }
+StringLiteral::StringLiteral(std::string_view v)
+    : Expression(NodeKind::StringLiteral), value(v) {}
+std::string StringLiteral::token_literal() const { return std::string{value}; }
+std::string StringLiteral::to_string() const { return std::string{value}; }
 // }}}
 
 // {{{ ArrayLiteral
-ArrayLiteral::ArrayLiteral(std::vector<std::shared_ptr<Expression>> v)
-    : elements(v) {}
+ArrayLiteral::ArrayLiteral(std::span<Expression *> v)
+    : Expression(NodeKind::ArrayLiteral), elements(v) {}
 std::string ArrayLiteral::token_literal() const { return "ARRAY"; }
 std::string ArrayLiteral::to_string() const {
   std::stringstream ss;
@@ -65,10 +73,8 @@ std::string ArrayLiteral::to_string() const {
 // }}}
 
 // {{{ HashLiteral
-HashLiteral::HashLiteral(
-    std::unordered_map<std::shared_ptr<Expression>, std::shared_ptr<Expression>>
-        v)
-    : pairs(v) {}
+HashLiteral::HashLiteral(std::span<Pair> v)
+    : Expression(NodeKind::HashLiteral), pairs(v) {}
 std::string HashLiteral::token_literal() const { return "HASH"; }
 std::string HashLiteral::to_string() const {
   std::stringstream ss;
@@ -87,19 +93,18 @@ std::string HashLiteral::to_string() const {
 // }}}
 
 // {{{ PrefixExpression
-PrefixExpression::PrefixExpression(token_types::TokenVariant prefix,
-                                   std::shared_ptr<Expression> e)
-    : oper(prefix), right(std::move(e)) {}
+PrefixExpression::PrefixExpression(TokenKind prefix, Expression *e)
+    : Expression(NodeKind::PrefixExpression), oper(prefix),
+      opcode(prefix_opcode(prefix)), right(e) {}
 std::string PrefixExpression::token_literal() const { return "PREFIX"; }
 std::string PrefixExpression::to_string() const {
-  return "(" + Token{oper}.literal() + right->to_string() + ")";
+  return "(" + literal_string(oper) + right->to_string() + ")";
 }
 // }}}
 
 // {{{ IndexExpression
-IndexExpression::IndexExpression(std::shared_ptr<Expression> left,
-                                 std::shared_ptr<Expression> index)
-    : left(std::move(left)), index(std::move(index)) {}
+IndexExpression::IndexExpression(Expression *left, Expression *index)
+    : Expression(NodeKind::IndexExpression), left(left), index(index) {}
 std::string IndexExpression::token_literal() const { return "INDEX"; }
 std::string IndexExpression::to_string() const {
   return "(" + left->to_string() + "[" + index->to_string() + "])";
@@ -107,22 +112,22 @@ std::string IndexExpression::to_string() const {
 // }}}
 
 // {{{ InfixExpression
-InfixExpression::InfixExpression(std::shared_ptr<Expression> left,
-                                 token_types::TokenVariant prefix,
-                                 std::shared_ptr<Expression> right)
-    : left(std::move(left)), oper(prefix), right(std::move(right)) {}
+InfixExpression::InfixExpression(Expression *left, TokenKind prefix,
+                                 Expression *right)
+    : Expression(NodeKind::InfixExpression), left(left), oper(prefix),
+      opcode(infix_opcode(prefix)), right(right) {}
 std::string InfixExpression::token_literal() const { return "INFIX"; }
 std::string InfixExpression::to_string() const {
-  return "(" + left->to_string() + " " + Token{oper}.literal() + " " +
+  return "(" + left->to_string() + " " + literal_string(oper) + " " +
          right->to_string() + ")";
 }
 // }}}
 
 // {{{ CallExpression
-CallExpression::CallExpression(
-    std::shared_ptr<Expression> function,
-    std::vector<std::shared_ptr<Expression>> &&arguments)
-    : function(std::move(function)), arguments(std::move(arguments)) {}
+CallExpression::CallExpression(Expression *function,
+                               std::span<Expression *> arguments)
+    : Expression(NodeKind::CallExpression), function(function),
+      arguments(arguments) {}
 std::string CallExpression::token_literal() const { return "CALL"; }
 std::string CallExpression::to_string() const {
   std::stringstream ss;
@@ -139,11 +144,10 @@ std::string CallExpression::to_string() const {
 // }}}
 
 // {{{ IfExpression
-IfExpression::IfExpression(std::shared_ptr<Expression> condition,
-                           std::shared_ptr<BlockStatement> consequence,
-                           std::shared_ptr<BlockStatement> alternative)
-    : condition(std::move(condition)), consequence(std::move(consequence)),
-      alternative(std::move(alternative)) {}
+IfExpression::IfExpression(Expression *condition, BlockStatement *consequence,
+                           BlockStatement *alternative)
+    : Expression(NodeKind::IfExpression), condition(condition),
+      consequence(consequence), alternative(alternative) {}
 std::string IfExpression::token_literal() const { return "if"; }
 std::string IfExpression::to_string() const {
   return "if (" + condition->to_string() + ") {\n" + consequence->to_string() +
@@ -153,8 +157,8 @@ std::string IfExpression::to_string() const {
 // }}}
 
 // {{{ LetStatement
-LetStatement::LetStatement(Identifier i, std::shared_ptr<Expression> v)
-    : identifier(i), value(std::move(v)) {}
+LetStatement::LetStatement(Identifier i, Expression *v)
+    : Statement(NodeKind::LetStatement), identifier(i), value(v) {}
 std::string LetStatement::token_literal() const { return "let"; }
 std::string LetStatement::to_string() const {
   return token_literal() + " " + identifier.to_string() + " = " +
@@ -163,8 +167,8 @@ std::string LetStatement::to_string() const {
 // }}}
 
 // {{{ ReturnStatement
-ReturnStatement::ReturnStatement(std::shared_ptr<Expression> v)
-    : value(std::move(v)) {}
+ReturnStatement::ReturnStatement(Expression *v)
+    : Statement(NodeKind::ReturnStatement), value(v) {}
 std::string ReturnStatement::token_literal() const { return "RETURN"; }
 std::string ReturnStatement::to_string() const {
   return token_literal() + " " + value->to_string() + ";";
@@ -172,8 +176,8 @@ std::string ReturnStatement::to_string() const {
 // }}}
 
 // {{{ ExpressionStatement
-ExpressionStatement::ExpressionStatement(std::shared_ptr<Expression> v)
-    : value(std::move(v)) {}
+ExpressionStatement::ExpressionStatement(Expression *v)
+    : Statement(NodeKind::ExpressionStatement), value(v) {}
 std::string ExpressionStatement::token_literal() const { return "EXPRESSION"; }
 std::string ExpressionStatement::to_string() const {
   return value->to_string();
@@ -181,6 +185,8 @@ std::string ExpressionStatement::to_string() const {
 // }}}
 
 // {{{ BlockStatement
+BlockStatement::BlockStatement(std::span<Statement *> s)
+    : Statement(NodeKind::BlockStatement), statements(s) {}
 std::string BlockStatement::token_literal() const { return "BLOCK"; }
 std::string BlockStatement::to_string() const {
   std::stringstream ss;
@@ -192,9 +198,23 @@ std::string BlockStatement::to_string() const {
 // }}}
 
 // {{{ FunctionLiteral
-FunctionLiteral::FunctionLiteral(std::vector<Identifier> params,
-                                 std::shared_ptr<BlockStatement> body)
-    : params(params), body(std::move(body)) {}
+FunctionLiteral::FunctionLiteral(std::span<Identifier> params,
+                                 BlockStatement *body, AstArena *arena)
+    : Expression(NodeKind::FunctionLiteral), params(params), arena(arena),
+      parsed(body), lazy(nullptr) {}
+FunctionLiteral::FunctionLiteral(std::span<Identifier> params, LazyBody *lazy,
+                                 AstArena *arena)
+    : Expression(NodeKind::FunctionLiteral), params(params), arena(arena),
+      parsed(nullptr), lazy(lazy) {}
+BlockStatement *FunctionLiteral::body() const {
+  if (!parsed && lazy && lazy->error.empty()) {
+    parsed = lazy->parse(*lazy, *arena);
+  }
+  return parsed;
+}
+std::string_view FunctionLiteral::body_error() const {
+  return lazy ? lazy->error : std::string_view{};
+}
 std::string FunctionLiteral::token_literal() const { return "FUNCTION"; }
 std::string FunctionLiteral::to_string() const {
   std::stringstream ss;
@@ -205,7 +225,13 @@ std::string FunctionLiteral::to_string() const {
       ss << ", ";
     }
   }
-  ss << ") {\n" << body->to_string() << "}";
+  ss << ") {\n";
+  if (auto *block{body()}) {
+    ss << block->to_string();
+  } else {
+    ss << "<" << body_error() << ">\n";
+  }
+  ss << "}";
   return ss.str();
 }
 // }}}
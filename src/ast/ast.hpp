@@ -1,39 +1,180 @@
 #pragma once
 #include "../token/token.hpp"
+#include "arena.hpp"
 #include <memory>
-#include <unordered_map>
+#include <span>
+#include <utility>
 #include <vector>
 
+// Statements and expressions live in the AstArena of the Program they were
+// parsed into and point at their children with raw pointers. Nodes have no
+// virtual destructors: the arena runs each non-trivial one itself, through the
+// concrete type it was made with, when the arena is dropped.
+
 // {{{ Interfaces
+// The concrete class of a node, so hot paths can switch on it instead of
+// trying dynamic_casts
+enum class NodeKind : uint8_t {
+  Program,
+  // Expressions
+  Identifier,
+  BooleanLiteral,
+  IntegerLiteral,
+  StringLiteral,
+  ArrayLiteral,
+  HashLiteral,
+  PrefixExpression,
+  IndexExpression,
+  InfixExpression,
+  CallExpression,
+  IfExpression,
+  FunctionLiteral,
+  // Statements
+  LetStatement,
+  ReturnStatement,
+  ExpressionStatement,
+  BlockStatement,
+  // Quickened forms the evaluator rewrites nodes to once it has seen what
+  // they operate on, and back when that changes. The class stays the same.
+  IntegerInfix,         // InfixExpression on two integers
+  IntegerConstantInfix, // the same with an integer literal on the right
+  ArrayIndex,           // IndexExpression of an array by an integer
+  GlobalCall,           // CallExpression of a function bound to a global
+};
+
+// What a quickened kind was parsed as
+constexpr NodeKind generic_kind(NodeKind kind) {
+  switch (kind) {
+  case NodeKind::IntegerInfix:
+  case NodeKind::IntegerConstantInfix:
+    return NodeKind::InfixExpression;
+  case NodeKind::ArrayIndex:
+    return NodeKind::IndexExpression;
+  case NodeKind::GlobalCall:
+    return NodeKind::CallExpression;
+  default:
+    return kind;
+  }
+}
+
 class Node {
 public:
+  Node(NodeKind kind) : kind(kind) {}
   virtual std::string token_literal() const = 0;
   virtual std::string to_string() const = 0;
+  NodeKind kind;
 };
 
 class Statement : public Node {
 public:
-  virtual ~Statement() = default;
+  using Node::Node;
 };
 class Expression : public Node {
 public:
-  virtual ~Expression() = default;
+  using Node::Node;
+};
+// }}}
+
+// {{{ Operators
+// Operator tokens lowered to what they do, so the evaluator can index its
+// dispatch tables with them. Tokens that aren't operators lower to Invalid.
+enum class Opcode : uint8_t {
+  // Infix
+  Add,
+  Sub,
+  Mul,
+  Div,
+  Lt,
+  Gt,
+  Eq,
+  NotEq,
+  // Prefix
+  Not,
+  Neg,
+  Invalid,
 };
+inline constexpr size_t OPCODE_COUNT{static_cast<size_t>(Opcode::Invalid) + 1};
+
+constexpr Opcode infix_opcode(TokenKind kind) {
+  switch (kind) {
+  case TokenKind::Plus:
+    return Opcode::Add;
+  case TokenKind::Minus:
+    return Opcode::Sub;
+  case TokenKind::Asterisk:
+    return Opcode::Mul;
+  case TokenKind::Slash:
+    return Opcode::Div;
+  case TokenKind::LT:
+    return Opcode::Lt;
+  case TokenKind::GT:
+    return Opcode::Gt;
+  case TokenKind::Eq:
+    return Opcode::Eq;
+  case TokenKind::NotEq:
+    return Opcode::NotEq;
+  default:
+    return Opcode::Invalid;
+  }
+}
+
+constexpr Opcode prefix_opcode(TokenKind kind) {
+  switch (kind) {
+  case TokenKind::Bang:
+    return Opcode::Not;
+  case TokenKind::Minus:
+    return Opcode::Neg;
+  default:
+    return Opcode::Invalid;
+  }
+}
+
+// For error messages
+constexpr TokenKind opcode_token(Opcode op) {
+  constexpr TokenKind tokens[]{
+      TokenKind::Plus, TokenKind::Minus, TokenKind::Asterisk, TokenKind::Slash,
+      TokenKind::LT,   TokenKind::GT,    TokenKind::Eq,       TokenKind::NotEq,
+      TokenKind::Bang, TokenKind::Minus, TokenKind::Illegal,
+  };
+  static_assert(std::size(tokens) == OPCODE_COUNT);
+  return tokens[static_cast<size_t>(op)];
+}
 // }}}
+class Object;
+
 class Program : public Node {
 public:
+  Program();
+  Program(std::shared_ptr<AstArena>);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
-  std::vector<std::shared_ptr<Statement>> statements{};
+  std::shared_ptr<AstArena> arena;
+  std::vector<Statement *> statements{};
 };
 
 // {{{ Expresssions
 class Identifier : public Expression {
 public:
-  Identifier(std::string);
+  Identifier(Symbol);
+  Identifier(std::string_view);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
-  std::string value;
+  Symbol symbol;
+  // Interned name, valid for the whole run
+  std::string_view value;
+  // Filled in by resolve(): where the current call keeps the variable.
+  // Globals, builtins and anything never resolved are looked up by symbol.
+  enum class Binding : uint8_t {
+    Global,
+    // A local of the call, `slot` in its slots or, if some closure captures
+    // it, in its cells
+    Local,
+    Cell,
+    // One of the closure's captures
+    Capture,
+  };
+  Binding binding{Binding::Global};
+  uint32_t slot{0};
 };
 
 class BooleanLiteral : public Expression {
@@ -50,72 +191,83 @@ public:
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
   IntType value;
+  // Built the first time the literal is evaluated, then shared
+  std::shared_ptr<Object> constant{};
 };
 
 class StringLiteral : public Expression {
 public:
-  StringLiteral(const std::string &);
+  // `value` has to outlive the node, usually it is copied into the arena
+  StringLiteral(std::string_view);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
-  std::string value;
+  std::string_view value;
+  // Built the first time the literal is evaluated, then shared
+  std::shared_ptr<Object> constant{};
 };
 
 class ArrayLiteral : public Expression {
 public:
-  ArrayLiteral(std::vector<std::shared_ptr<Expression>>);
+  ArrayLiteral(std::span<Expression *>);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
-  std::vector<std::shared_ptr<Expression>> elements;
+  std::span<Expression *> elements;
 };
 
 class HashLiteral : public Expression {
 public:
-  HashLiteral(std::unordered_map<std::shared_ptr<Expression>,
-                                 std::shared_ptr<Expression>>);
+  using Pair = std::pair<Expression *, Expression *>;
+  HashLiteral(std::span<Pair>);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
-  std::unordered_map<std::shared_ptr<Expression>, std::shared_ptr<Expression>>
-      pairs;
+  // In source order
+  std::span<Pair> pairs;
 };
 
 class PrefixExpression : public Expression {
 public:
-  PrefixExpression(token_types::TokenVariant, std::shared_ptr<Expression>);
+  PrefixExpression(TokenKind, Expression *);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
-  token_types::TokenVariant oper;
-  std::shared_ptr<Expression> right;
+  TokenKind oper;
+  Opcode opcode;
+  Expression *right;
 };
 
 class IndexExpression : public Expression {
 public:
-  IndexExpression(std::shared_ptr<Expression> left,
-                  std::shared_ptr<Expression> index);
+  IndexExpression(Expression *left, Expression *index);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
-  std::shared_ptr<Expression> left;
-  std::shared_ptr<Expression> index;
+  Expression *left;
+  Expression *index;
 };
 
 class InfixExpression : public Expression {
 public:
-  InfixExpression(std::shared_ptr<Expression>, token_types::TokenVariant,
-                  std::shared_ptr<Expression>);
+  InfixExpression(Expression *, TokenKind, Expression *);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
-  std::shared_ptr<Expression> left;
-  token_types::TokenVariant oper;
-  std::shared_ptr<Expression> right;
+  Expression *left;
+  TokenKind oper;
+  Opcode opcode;
+  Expression *right;
 };
 
 class CallExpression : public Expression {
 public:
-  CallExpression(std::shared_ptr<Expression>,
-                 std::vector<std::shared_ptr<Expression>> &&);
+  CallExpression(Expression *, std::span<Expression *>);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
-  std::shared_ptr<Expression> function;
-  std::vector<std::shared_ptr<Expression>> arguments;
+  Expression *function;
+  std::span<Expression *> arguments;
+  // Set by mark_tail_calls(): the call's value is what the enclosing
+  // function returns
+  bool tail{false};
+  // For GlobalCall: the global the function was found in, in the
+  // environment with that id
+  uint64_t globals_id{0};
+  std::shared_ptr<Object> *global{nullptr};
 };
 
 // Forward decl
@@ -123,56 +275,111 @@ class BlockStatement;
 
 class IfExpression : public Expression {
 public:
-  IfExpression(std::shared_ptr<Expression>, std::shared_ptr<BlockStatement>,
-               std::shared_ptr<BlockStatement>);
+  IfExpression(Expression *, BlockStatement *, BlockStatement *);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
-  std::shared_ptr<Expression> condition;
-  std::shared_ptr<BlockStatement> consequence;
-  std::shared_ptr<BlockStatement> alternative;
+  Expression *condition;
+  BlockStatement *consequence;
+  BlockStatement *alternative;
+};
+
+struct TokenBuffer;
+
+// Where a new closure gets a captured variable from: one of the cells of the
+// call creating it, or one of that call's own captures
+struct Capture {
+  bool cell;
+  uint32_t index;
+};
+
+// A local that has the name of a variable of an enclosing function, which
+// the function captures as `capture`. Until it is assigned, the local reads
+// that variable.
+struct Shadow {
+  uint32_t local;
+  uint32_t capture;
+};
+
+// A function body the parser only brace-matched. It is parsed into the
+// function's arena by `parse` the first time the body is needed.
+struct LazyBody {
+  BlockStatement *(*parse)(LazyBody &, AstArena &);
+  // Kept alive by the arena
+  const TokenBuffer *tokens;
+  // The opening brace, and one past the closing one
+  size_t begin;
+  size_t end;
+  bool explicit_stack;
+  // First parse error, if parsing failed
+  std::string_view error;
 };
 
 class FunctionLiteral : public Expression {
 public:
-  FunctionLiteral(std::vector<Identifier>, std::shared_ptr<BlockStatement>);
+  FunctionLiteral(std::span<Identifier>, BlockStatement *, AstArena *);
+  FunctionLiteral(std::span<Identifier>, LazyBody *, AstArena *);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
-  std::vector<Identifier> params;
-  std::shared_ptr<BlockStatement> body;
+  // Parses a lazy body on first use. Null if that fails, with the reason in
+  // body_error().
+  BlockStatement *body() const;
+  std::string_view body_error() const;
+  // False until a lazy body has been parsed
+  bool body_parsed() const { return parsed || !lazy; }
+  std::span<Identifier> params;
+  // Closures keep the arena alive through this
+  AstArena *arena;
+  // Filled in by resolve(): one slot per parameter and local, which of them
+  // closures capture, and what this function captures itself
+  std::span<const Symbol> locals{};
+  std::span<const uint32_t> cells{};
+  std::span<const Capture> captures{};
+  std::span<const Shadow> shadows{};
+  // The local a literal bound by a let inside a function reads itself
+  // through. Calls start with the function in it, so recursion needs no
+  // cell that the function's own captures would keep alive.
+  static constexpr uint32_t NO_SELF{UINT32_MAX};
+  uint32_t self{NO_SELF};
+  bool resolved{false};
+
+private:
+  mutable BlockStatement *parsed;
+  LazyBody *lazy;
 };
 // }}}
 
 // {{{ Statements
 class LetStatement : public Statement {
 public:
-  LetStatement(Identifier, std::shared_ptr<Expression>);
+  LetStatement(Identifier, Expression *);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
   Identifier identifier;
-  std::shared_ptr<Expression> value;
+  Expression *value;
 };
 
 class ReturnStatement : public Statement {
 public:
-  ReturnStatement(std::shared_ptr<Expression>);
+  ReturnStatement(Expression *);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
-  std::shared_ptr<Expression> value;
+  Expression *value;
 };
 
 class ExpressionStatement : public Statement {
 public:
-  ExpressionStatement(std::shared_ptr<Expression>);
+  ExpressionStatement(Expression *);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
-  std::shared_ptr<Expression> value;
+  Expression *value;
 };
 
 class BlockStatement : public Statement {
 public:
+  BlockStatement(std::span<Statement *>);
   virtual std::string token_literal() const override;
   virtual std::string to_string() const override;
-  std::vector<std::shared_ptr<Statement>> statements{};
+  std::span<Statement *> statements;
 };
 // }}}
 
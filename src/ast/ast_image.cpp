@@ -0,0 +1,554 @@
+#include "ast_image.hpp"
+#include "../lexer/source.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+// "MONKEAST", reads back differently on a machine with the other byte order
+constexpr uint64_t MAGIC{0x5453414b454e4f4d};
+constexpr uint32_t NONE{~0u};
+
+enum class Tag : uint8_t {
+  // Expressions
+  Identifier,
+  Integer,
+  Boolean,
+  String,
+  Array,
+  Hash,
+  Prefix,
+  Infix,
+  Index,
+  Call,
+  If,
+  Function,
+  // Statements
+  Let,
+  Return,
+  Expression,
+  Block,
+};
+
+bool is_expression(Tag tag) { return tag <= Tag::Function; }
+bool is_statement(Tag tag) { return Tag::Let <= tag && tag <= Tag::Block; }
+
+struct Header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t statement_count;
+  uint64_t source_hash;
+  uint64_t source_length;
+  uint32_t node_count;
+  uint32_t list_count;
+  uint32_t string_count;
+  uint32_t string_bytes;
+};
+
+// Children are node indices, lists are (start, count) into the list pool and
+// names are string ids. An integer is split over `a` (low) and `b` (high).
+struct Record {
+  Tag tag;
+  uint8_t oper;
+  uint16_t unused;
+  uint32_t a;
+  uint32_t b;
+  uint32_t c;
+};
+static_assert(sizeof(Record) == 16);
+
+struct StringEntry {
+  uint32_t offset;
+  uint32_t length;
+};
+
+// {{{ Writing
+class Writer {
+public:
+  uint32_t node(const Node *);
+  uint32_t string(std::string_view);
+  bool ok{true};
+  std::vector<Record> records{};
+  std::vector<uint32_t> lists{};
+  std::vector<StringEntry> strings{};
+  std::string bytes{};
+
+private:
+  // Appends what `n` points at, in the order its record refers to them
+  static void children(const Node *n, std::vector<const Node *> &out);
+  // Emits `n` once its children have been, at the given indices
+  uint32_t finish(const Node *n, std::span<const uint32_t> children);
+  uint32_t emit(Tag tag, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0,
+                uint8_t oper = 0);
+  uint32_t list(std::span<const uint32_t>);
+  std::unordered_map<std::string_view, uint32_t> string_ids{};
+};
+
+uint32_t Writer::emit(Tag tag, uint32_t a, uint32_t b, uint32_t c,
+                      uint8_t oper) {
+  records.push_back(Record{tag, oper, 0, a, b, c});
+  return records.size() - 1;
+}
+
+uint32_t Writer::string(std::string_view s) {
+  auto [it, inserted]{string_ids.try_emplace(s, strings.size())};
+  if (inserted) {
+    strings.push_back(StringEntry{static_cast<uint32_t>(bytes.size()),
+                                  static_cast<uint32_t>(s.length())});
+    bytes.append(s);
+  }
+  return it->second;
+}
+
+uint32_t Writer::list(std::span<const uint32_t> indices) {
+  lists.insert(lists.end(), indices.begin(), indices.end());
+  return lists.size() - indices.size();
+}
+
+// Post-order on an explicit stack, so deeply nested programs don't overflow
+// the C++ one: a node is expanded into its children first and finished once
+// their indices are on `done`
+uint32_t Writer::node(const Node *root) {
+  struct Pending {
+    const Node *node;
+    // NONE until expanded
+    uint32_t children;
+  };
+  std::vector<Pending> pending{{root, NONE}};
+  std::vector<uint32_t> done{};
+  std::vector<const Node *> found{};
+  while (!pending.empty()) {
+    auto [n, count]{pending.back()};
+    if (count != NONE) {
+      pending.pop_back();
+      auto first{done.size() - count};
+      auto index{finish(n, {done.data() + first, count})};
+      done.resize(first);
+      done.push_back(index);
+      continue;
+    }
+    found.clear();
+    children(n, found);
+    pending.back().children = found.size();
+    for (auto it{found.rbegin()}; it != found.rend(); ++it) {
+      pending.push_back({*it, NONE});
+    }
+  }
+  return done.back();
+}
+
+void Writer::children(const Node *n, std::vector<const Node *> &out) {
+  switch (n ? generic_kind(n->kind) : NodeKind::Program) {
+  case NodeKind::ArrayLiteral: {
+    auto &elements{static_cast<const ArrayLiteral *>(n)->elements};
+    out.insert(out.end(), elements.begin(), elements.end());
+    break;
+  }
+  case NodeKind::HashLiteral: {
+    auto &pairs{static_cast<const HashLiteral *>(n)->pairs};
+    for (const auto &[key, value] : pairs) {
+      out.insert(out.end(), {key, value});
+    }
+    break;
+  }
+  case NodeKind::PrefixExpression:
+    out.push_back(static_cast<const PrefixExpression *>(n)->right);
+    break;
+  case NodeKind::InfixExpression: {
+    auto *e{static_cast<const InfixExpression *>(n)};
+    out.push_back(e->left);
+    out.push_back(e->right);
+    break;
+  }
+  case NodeKind::IndexExpression: {
+    auto *e{static_cast<const IndexExpression *>(n)};
+    out.push_back(e->left);
+    out.push_back(e->index);
+    break;
+  }
+  case NodeKind::CallExpression: {
+    auto *e{static_cast<const CallExpression *>(n)};
+    out.push_back(e->function);
+    out.insert(out.end(), e->arguments.begin(), e->arguments.end());
+    break;
+  }
+  case NodeKind::IfExpression: {
+    auto *e{static_cast<const IfExpression *>(n)};
+    out.push_back(e->condition);
+    out.push_back(e->consequence);
+    if (e->alternative) {
+      out.push_back(e->alternative);
+    }
+    break;
+  }
+  case NodeKind::FunctionLiteral:
+    out.push_back(static_cast<const FunctionLiteral *>(n)->body());
+    break;
+  case NodeKind::LetStatement:
+    out.push_back(static_cast<const LetStatement *>(n)->value);
+    break;
+  case NodeKind::ReturnStatement:
+    out.push_back(static_cast<const ReturnStatement *>(n)->value);
+    break;
+  case NodeKind::ExpressionStatement:
+    out.push_back(static_cast<const ExpressionStatement *>(n)->value);
+    break;
+  case NodeKind::BlockStatement: {
+    auto &statements{static_cast<const BlockStatement *>(n)->statements};
+    out.insert(out.end(), statements.begin(), statements.end());
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+uint32_t Writer::finish(const Node *n, std::span<const uint32_t> children) {
+  switch (n ? generic_kind(n->kind) : NodeKind::Program) {
+  case NodeKind::Identifier:
+    return emit(Tag::Identifier,
+                string(static_cast<const Identifier *>(n)->value));
+  case NodeKind::IntegerLiteral: {
+    auto value{
+        static_cast<uint64_t>(static_cast<const IntegerLiteral *>(n)->value)};
+    return emit(Tag::Integer, static_cast<uint32_t>(value), value >> 32);
+  }
+  case NodeKind::BooleanLiteral:
+    return emit(Tag::Boolean, static_cast<const BooleanLiteral *>(n)->value);
+  case NodeKind::StringLiteral:
+    return emit(Tag::String,
+                string(static_cast<const StringLiteral *>(n)->value));
+  case NodeKind::ArrayLiteral:
+    return emit(Tag::Array, list(children), children.size());
+  case NodeKind::HashLiteral:
+    return emit(Tag::Hash, list(children), children.size() / 2);
+  case NodeKind::PrefixExpression:
+    return emit(Tag::Prefix, children[0], 0, 0,
+                kind_index(static_cast<const PrefixExpression *>(n)->oper));
+  case NodeKind::InfixExpression:
+    return emit(Tag::Infix, children[0], children[1], 0,
+                kind_index(static_cast<const InfixExpression *>(n)->oper));
+  case NodeKind::IndexExpression:
+    return emit(Tag::Index, children[0], children[1]);
+  case NodeKind::CallExpression:
+    return emit(Tag::Call, children[0], list(children.subspan(1)),
+                children.size() - 1);
+  case NodeKind::IfExpression:
+    return emit(Tag::If, children[0], children[1],
+                children.size() > 2 ? children[2] : NONE);
+  case NodeKind::FunctionLiteral: {
+    auto &params{static_cast<const FunctionLiteral *>(n)->params};
+    auto start{lists.size()};
+    for (const auto &param : params) {
+      lists.push_back(string(param.value));
+    }
+    return emit(Tag::Function, start, params.size(), children[0]);
+  }
+  case NodeKind::LetStatement:
+    return emit(Tag::Let,
+                string(static_cast<const LetStatement *>(n)->identifier.value),
+                children[0]);
+  case NodeKind::ReturnStatement:
+    return emit(Tag::Return, children[0]);
+  case NodeKind::ExpressionStatement:
+    return emit(Tag::Expression, children[0]);
+  case NodeKind::BlockStatement:
+    return emit(Tag::Block, list(children), children.size());
+  default:
+    break;
+  }
+  // Only complete parses are cached
+  ok = false;
+  return NONE;
+}
+// }}}
+
+// {{{ Loading
+class Reader {
+public:
+  Reader(std::string_view image, AstArena &arena)
+      : image(image), arena(arena) {}
+  bool check(std::string_view source);
+  bool decode();
+  std::vector<Statement *> statements{};
+
+private:
+  template <typename T> const T *section(uint64_t &offset, uint64_t count);
+  Node *build(const Record &, uint32_t self);
+  Expression *expression(uint32_t index, uint32_t self);
+  Statement *statement(uint32_t index, uint32_t self);
+  BlockStatement *block(uint32_t index, uint32_t self);
+  const uint32_t *list(uint32_t start, uint64_t count);
+  std::string_view string(uint32_t id);
+  Symbol symbol(uint32_t id);
+
+  std::string_view image;
+  AstArena &arena;
+  Header header{};
+  const Record *records{nullptr};
+  const uint32_t *top_level{nullptr};
+  const uint32_t *lists{nullptr};
+  const StringEntry *strings{nullptr};
+  const char *bytes{nullptr};
+  std::vector<Node *> nodes{};
+  std::vector<Symbol> symbols{};
+  bool ok{true};
+};
+
+template <typename T>
+const T *Reader::section(uint64_t &offset, uint64_t count) {
+  auto *start{image.data() + offset};
+  offset += count * sizeof(T);
+  return reinterpret_cast<const T *>(start);
+}
+
+bool Reader::check(std::string_view source) {
+  if (image.length() < sizeof(Header)) {
+    return false;
+  }
+  std::memcpy(&header, image.data(), sizeof(Header));
+  if (header.magic != MAGIC || header.version != ast_image::VERSION ||
+      header.source_length != source.length() ||
+      header.source_hash != ast_image::hash_source(source)) {
+    return false;
+  }
+  auto size{sizeof(Header) + uint64_t{header.node_count} * sizeof(Record) +
+            (uint64_t{header.statement_count} + header.list_count) * 4 +
+            uint64_t{header.string_count} * sizeof(StringEntry) +
+            header.string_bytes};
+  if (size != image.length()) {
+    return false;
+  }
+  uint64_t offset{sizeof(Header)};
+  records = section<Record>(offset, header.node_count);
+  top_level = section<uint32_t>(offset, header.statement_count);
+  lists = section<uint32_t>(offset, header.list_count);
+  strings = section<StringEntry>(offset, header.string_count);
+  bytes = section<char>(offset, header.string_bytes);
+  return true;
+}
+
+bool Reader::decode() {
+  nodes.resize(header.node_count);
+  symbols.assign(header.string_count, NONE);
+  for (uint32_t i = 0; i < header.node_count && ok; ++i) {
+    nodes[i] = build(records[i], i);
+  }
+  for (uint32_t i = 0; i < header.statement_count && ok; ++i) {
+    statements.push_back(statement(top_level[i], header.node_count));
+  }
+  return ok;
+}
+
+// Children come before their parents, which also rules out cycles
+Expression *Reader::expression(uint32_t index, uint32_t self) {
+  if (index >= self || !is_expression(records[index].tag)) {
+    ok = false;
+    return nullptr;
+  }
+  return static_cast<Expression *>(nodes[index]);
+}
+
+Statement *Reader::statement(uint32_t index, uint32_t self) {
+  if (index >= self || !is_statement(records[index].tag)) {
+    ok = false;
+    return nullptr;
+  }
+  return static_cast<Statement *>(nodes[index]);
+}
+
+BlockStatement *Reader::block(uint32_t index, uint32_t self) {
+  if (index >= self || records[index].tag != Tag::Block) {
+    ok = false;
+    return nullptr;
+  }
+  return static_cast<BlockStatement *>(nodes[index]);
+}
+
+const uint32_t *Reader::list(uint32_t start, uint64_t count) {
+  if (start + count > header.list_count) {
+    ok = false;
+    return nullptr;
+  }
+  return lists + start;
+}
+
+std::string_view Reader::string(uint32_t id) {
+  if (id >= header.string_count ||
+      uint64_t{strings[id].offset} + strings[id].length > header.string_bytes) {
+    ok = false;
+    return {};
+  }
+  return {bytes + strings[id].offset, strings[id].length};
+}
+
+Symbol Reader::symbol(uint32_t id) {
+  auto name{string(id)};
+  if (!ok) {
+    return 0;
+  }
+  if (symbols[id] == NONE) {
+    symbols[id] = intern(name);
+  }
+  return symbols[id];
+}
+
+Node *Reader::build(const Record &r, uint32_t self) {
+  auto oper{static_cast<TokenKind>(r.oper)};
+  switch (r.tag) {
+  case Tag::Identifier:
+    return arena.make<Identifier>(symbol(r.a));
+  case Tag::Integer:
+    return arena.make<IntegerLiteral>(
+        static_cast<IntType>(uint64_t{r.a} | uint64_t{r.b} << 32));
+  case Tag::Boolean:
+    return arena.make<BooleanLiteral>(r.a != 0);
+  case Tag::String:
+    return arena.make<StringLiteral>(arena.copy(string(r.a)));
+  case Tag::Array:
+  case Tag::Call: {
+    auto start{r.tag == Tag::Array ? r.a : r.b};
+    auto count{r.tag == Tag::Array ? r.b : r.c};
+    auto *indices{list(start, count)};
+    std::vector<Expression *> elements{};
+    for (uint32_t i = 0; i < count && ok; ++i) {
+      elements.push_back(expression(indices[i], self));
+    }
+    if (r.tag == Tag::Array) {
+      return arena.make<ArrayLiteral>(arena.copy(elements));
+    }
+    return arena.make<CallExpression>(expression(r.a, self),
+                                      arena.copy(elements));
+  }
+  case Tag::Hash: {
+    auto *indices{list(r.a, uint64_t{r.b} * 2)};
+    std::vector<HashLiteral::Pair> pairs{};
+    for (uint32_t i = 0; i < r.b && ok; ++i) {
+      pairs.emplace_back(expression(indices[2 * i], self),
+                         expression(indices[2 * i + 1], self));
+    }
+    return arena.make<HashLiteral>(arena.copy(pairs));
+  }
+  case Tag::Prefix:
+    if (r.oper >= TOKEN_KIND_COUNT || prefix_opcode(oper) == Opcode::Invalid) {
+      break;
+    }
+    return arena.make<PrefixExpression>(oper, expression(r.a, self));
+  case Tag::Infix:
+    if (r.oper >= TOKEN_KIND_COUNT || infix_opcode(oper) == Opcode::Invalid) {
+      break;
+    }
+    return arena.make<InfixExpression>(expression(r.a, self), oper,
+                                       expression(r.b, self));
+  case Tag::Index:
+    return arena.make<IndexExpression>(expression(r.a, self),
+                                       expression(r.b, self));
+  case Tag::If:
+    return arena.make<IfExpression>(expression(r.a, self), block(r.b, self),
+                                    r.c == NONE ? nullptr : block(r.c, self));
+  case Tag::Function: {
+    auto *ids{list(r.a, r.b)};
+    std::vector<Identifier> params{};
+    for (uint32_t i = 0; i < r.b && ok; ++i) {
+      params.emplace_back(symbol(ids[i]));
+    }
+    return arena.make<FunctionLiteral>(arena.copy(params), block(r.c, self),
+                                       &arena);
+  }
+  case Tag::Let:
+    return arena.make<LetStatement>(Identifier{symbol(r.a)},
+                                    expression(r.b, self));
+  case Tag::Return:
+    return arena.make<ReturnStatement>(expression(r.a, self));
+  case Tag::Expression:
+    return arena.make<ExpressionStatement>(expression(r.a, self));
+  case Tag::Block: {
+    auto *indices{list(r.a, r.b)};
+    std::vector<Statement *> statements{};
+    for (uint32_t i = 0; i < r.b && ok; ++i) {
+      statements.push_back(statement(indices[i], self));
+    }
+    return arena.make<BlockStatement>(arena.copy(statements));
+  }
+  }
+  ok = false;
+  return nullptr;
+}
+// }}}
+} // namespace
+
+namespace ast_image {
+std::string path_for(const std::string &source_path) {
+  return source_path + ".ast";
+}
+
+// FNV-1a
+uint64_t hash_source(std::string_view source) {
+  uint64_t hash{0xcbf29ce484222325};
+  for (unsigned char ch : source) {
+    hash = (hash ^ ch) * 0x100000001b3;
+  }
+  return hash;
+}
+
+bool write(const Program &program, std::string_view source,
+           const std::string &path) {
+  Writer writer{};
+  std::vector<uint32_t> statements{};
+  for (auto *s : program.statements) {
+    statements.push_back(writer.node(s));
+  }
+  if (!writer.ok) {
+    return false;
+  }
+
+  Header header{MAGIC,
+                VERSION,
+                static_cast<uint32_t>(statements.size()),
+                hash_source(source),
+                source.length(),
+                static_cast<uint32_t>(writer.records.size()),
+                static_cast<uint32_t>(writer.lists.size()),
+                static_cast<uint32_t>(writer.strings.size()),
+                static_cast<uint32_t>(writer.bytes.size())};
+  // Written under a temporary name so readers never see half an image
+  auto temporary{path + ".tmp"};
+  {
+    std::ofstream out{temporary, std::ios::binary | std::ios::trunc};
+    auto put{[&out](const auto &items) {
+      out.write(reinterpret_cast<const char *>(items.data()),
+                items.size() * sizeof(items[0]));
+    }};
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    put(writer.records);
+    put(statements);
+    put(writer.lists);
+    put(writer.strings);
+    put(writer.bytes);
+    if (!out) {
+      std::remove(temporary.c_str());
+      return false;
+    }
+  }
+  return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+std::shared_ptr<Program> load(const std::string &path,
+                              std::string_view source) {
+  auto image{Source::map_file(path)};
+  if (!image) {
+    return nullptr;
+  }
+  auto program{std::make_shared<Program>()};
+  Reader reader{image->view(), *program->arena};
+  if (!reader.check(source) || !reader.decode()) {
+    return nullptr;
+  }
+  program->statements = std::move(reader.statements);
+  return program;
+}
+} // namespace ast_image
+
+// vim:foldmethod=marker
@@ -0,0 +1,28 @@
+#pragma once
+#include "ast.hpp"
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Precompiled AST images. An image is a flat, offset-based dump of a Program:
+// a header, one fixed-size record per node in post-order (children before
+// parents, referenced by index), the top-level statement list, a pool of
+// index lists, and a string table. Loading maps the file and rebuilds the
+// nodes in a single pass, without lexing or parsing.
+//
+// Images are a cache in native byte order. They carry a hash of the source
+// they were built from, and anything that doesn't match (version, byte
+// order, source, bounds) makes load() return nullptr so the caller can fall
+// back to parsing.
+namespace ast_image {
+inline constexpr uint32_t VERSION{1};
+
+// Where the image for `source_path` lives
+std::string path_for(const std::string &source_path);
+uint64_t hash_source(std::string_view source);
+// Returns false if `program` can't be written, e.g. it has parse errors
+bool write(const Program &program, std::string_view source,
+           const std::string &path);
+std::shared_ptr<Program> load(const std::string &path,
+                              std::string_view source);
+} // namespace ast_image
@@ -0,0 +1,320 @@
+#include "ast/ast.hpp"
+#include "parser/parser.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Lexer and parser throughput on generated corpora, printed as JSON so runs
+// can be diffed between builds. Every measurement runs in a child process to
+// get its own peak RSS.
+//
+//   ./bench_frontend [corpus bytes]
+
+// {{{ Allocation counting
+std::atomic<size_t> allocations{0};
+std::atomic<size_t> allocated_bytes{0};
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (auto *p{std::malloc(size ? size : 1)}) {
+    return p;
+  }
+  throw std::bad_alloc{};
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+// }}}
+
+// {{{ Corpora
+// Small deterministic generator, so every build sees the same input
+struct Random {
+  uint64_t state{0x9e3779b97f4a7c15};
+  uint64_t next() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  }
+  size_t below(size_t n) { return next() % n; }
+};
+
+// Identifiers can't have digits, so numbers are spelled in letters
+std::string name(size_t i, size_t min_length = 1) {
+  std::string out{"v_"};
+  do {
+    out += static_cast<char>('a' + i % 26);
+    i /= 26;
+  } while (i > 0 || out.size() < min_length + 2);
+  return out;
+}
+
+std::string identifiers(size_t size) {
+  Random r{};
+  std::string out{};
+  for (size_t i = 0; out.size() < size; ++i) {
+    out += "let " + name(i, 12 + r.below(20)) + " = " +
+           name(r.below(i + 1), 8) + " + " + name(r.below(i + 1), 16) +
+           " * " + name(r.below(64), 10) + "(" + name(r.below(i + 1), 4) +
+           ", " + name(r.below(i + 1), 24) + ");\n";
+  }
+  return out;
+}
+
+std::string arrays(size_t size) {
+  Random r{};
+  std::string out{};
+  while (out.size() < size) {
+    out += "let " + name(r.below(1000)) + " = [";
+    for (int i = 0; i < 10'000; ++i) {
+      out += i % 4 ? std::to_string(r.next() % 100'000) : "\"s\"";
+      out += ", ";
+    }
+    out += "0];\n";
+  }
+  return out;
+}
+
+std::string hashes(size_t size) {
+  Random r{};
+  std::string out{};
+  while (out.size() < size) {
+    out += "let " + name(r.below(1000)) + " = {";
+    for (int i = 0; i < 5'000; ++i) {
+      out += '"' + name(i) + "\": " + std::to_string(r.below(1000)) + ", ";
+    }
+    out += "\"end\": true};\n";
+  }
+  return out;
+}
+
+// Stays well inside what the recursive parser handles
+std::string nesting(size_t size) {
+  const int depth{2'000};
+  std::string out{};
+  while (out.size() < size) {
+    out += std::string(depth, '[') + "1" + std::string(depth, ']') + ";\n";
+    for (int i = 0; i < depth; ++i) {
+      out += "(a + ";
+    }
+    out += "1" + std::string(depth, ')') + ";\n";
+  }
+  return out;
+}
+
+std::string functions(size_t size) {
+  std::string out{};
+  for (size_t i = 0; out.size() < size; ++i) {
+    auto f{name(i)};
+    out += "let " + f + " = fn(a, b) { if (a < b) { return a; } let c = [a, " +
+           "b]; c[0] + len(c) };\n" + f + "(1, 2);\n";
+  }
+  return out;
+}
+
+std::string strings(size_t size) {
+  Random r{};
+  std::string out{};
+  while (out.size() < size) {
+    std::string text(10'000 + r.below(50'000), ' ');
+    for (auto &c : text) {
+      c = static_cast<char>('a' + r.below(26));
+    }
+    out += "let " + name(r.below(1000)) + " = \"" + text + "\";\n";
+  }
+  return out;
+}
+// }}}
+
+// {{{ Measuring
+size_t count_nodes(const Node *n) {
+  if (!n) {
+    return 0;
+  }
+  size_t count{1};
+  switch (generic_kind(n->kind)) {
+  case NodeKind::ArrayLiteral:
+    for (auto *element : static_cast<const ArrayLiteral *>(n)->elements) {
+      count += count_nodes(element);
+    }
+    break;
+  case NodeKind::HashLiteral: {
+    auto *e{static_cast<const HashLiteral *>(n)};
+    for (const auto &[key, value] : e->pairs) {
+      count += count_nodes(key) + count_nodes(value);
+    }
+    break;
+  }
+  case NodeKind::PrefixExpression:
+    count += count_nodes(static_cast<const PrefixExpression *>(n)->right);
+    break;
+  case NodeKind::InfixExpression: {
+    auto *e{static_cast<const InfixExpression *>(n)};
+    count += count_nodes(e->left) + count_nodes(e->right);
+    break;
+  }
+  case NodeKind::IndexExpression: {
+    auto *e{static_cast<const IndexExpression *>(n)};
+    count += count_nodes(e->left) + count_nodes(e->index);
+    break;
+  }
+  case NodeKind::CallExpression: {
+    auto *e{static_cast<const CallExpression *>(n)};
+    count += count_nodes(e->function);
+    for (auto *argument : e->arguments) {
+      count += count_nodes(argument);
+    }
+    break;
+  }
+  case NodeKind::IfExpression: {
+    auto *e{static_cast<const IfExpression *>(n)};
+    count += count_nodes(e->condition) + count_nodes(e->consequence) +
+             count_nodes(e->alternative);
+    break;
+  }
+  case NodeKind::FunctionLiteral: {
+    auto *e{static_cast<const FunctionLiteral *>(n)};
+    count += e->params.size() + count_nodes(e->body());
+    break;
+  }
+  case NodeKind::LetStatement:
+    count += 1 + count_nodes(static_cast<const LetStatement *>(n)->value);
+    break;
+  case NodeKind::ReturnStatement:
+    count += count_nodes(static_cast<const ReturnStatement *>(n)->value);
+    break;
+  case NodeKind::ExpressionStatement:
+    count += count_nodes(static_cast<const ExpressionStatement *>(n)->value);
+    break;
+  case NodeKind::BlockStatement:
+    for (auto *statement : static_cast<const BlockStatement *>(n)->statements) {
+      count += count_nodes(statement);
+    }
+    break;
+  default:
+    break;
+  }
+  return count;
+}
+
+struct Counts {
+  size_t tokens{0};
+  size_t nodes{0};
+};
+
+long peak_rss_kb() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// Phases only count AST nodes when asked to, outside the timed runs
+using Phase = Counts (*)(std::string_view, bool count_nodes);
+
+// Runs `phase` once to count allocations and peak RSS, then repeats it for
+// at least a quarter second and keeps the fastest run
+std::string measure(std::string_view source, Phase phase) {
+  auto rss_before{peak_rss_kb()};
+  allocations = 0;
+  allocated_bytes = 0;
+  phase(source, false);
+  size_t allocs{allocations};
+  size_t alloc_bytes{allocated_bytes};
+  auto rss{peak_rss_kb()};
+  auto counts{phase(source, true)};
+
+  using clock = std::chrono::steady_clock;
+  double best{1e30};
+  auto deadline{clock::now() + std::chrono::milliseconds(250)};
+  for (int runs = 0; runs < 3 || clock::now() < deadline; ++runs) {
+    auto start{clock::now()};
+    phase(source, false);
+    best = std::min(
+        best, std::chrono::duration<double>(clock::now() - start).count());
+  }
+
+  std::stringstream ss{};
+  ss << "{\"seconds\": " << best << ", \"tokens\": " << counts.tokens
+     << ", \"tokens_per_s\": " << counts.tokens / best
+     << ", \"bytes_per_s\": " << source.size() / best;
+  if (counts.nodes) {
+    ss << ", \"nodes\": " << counts.nodes
+       << ", \"nodes_per_s\": " << counts.nodes / best;
+  }
+  ss << ", \"allocations\": " << allocs
+     << ", \"allocated_bytes\": " << alloc_bytes
+     << ", \"peak_rss_kb\": " << rss
+     << ", \"rss_growth_kb\": " << rss - rss_before << "}";
+  return ss.str();
+}
+
+Counts lex(std::string_view source, bool) {
+  auto tokens{Lexer::borrow(source).tokenize_all()};
+  return {tokens.size(), 0};
+}
+
+Counts lex_parse(std::string_view source, bool nodes) {
+  auto tokens{
+      std::make_shared<TokenBuffer>(Lexer::borrow(source).tokenize_all())};
+  Parser parser{tokens};
+  auto program{parser.parse_program()};
+  Counts counts{tokens->size(), 0};
+  if (nodes) {
+    for (auto *statement : program->statements) {
+      counts.nodes += count_nodes(statement);
+    }
+  }
+  return counts;
+}
+
+// Prints what `measure` reports from a child process
+void isolated(std::string_view source, Phase phase) {
+  std::cout << std::flush;
+  auto pid{fork()};
+  if (pid == 0) {
+    std::cout << measure(source, phase) << std::flush;
+    _exit(0);
+  }
+  int status{0};
+  waitpid(pid, &status, 0);
+  if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    std::cout << "null";
+  }
+}
+// }}}
+
+int main(int argc, char *argv[]) {
+  size_t size{argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4 << 20};
+  struct Corpus {
+    const char *name;
+    std::string (*generate)(size_t);
+  };
+  Corpus corpora[]{
+      {"identifiers", identifiers}, {"arrays", arrays},
+      {"hashes", hashes},           {"nesting", nesting},
+      {"functions", functions},     {"strings", strings},
+  };
+
+  std::cout << "{\"corpus_bytes\": " << size << ", \"corpora\": [";
+  for (size_t i = 0; i < std::size(corpora); ++i) {
+    auto source{corpora[i].generate(size)};
+    std::cout << (i ? ",\n  " : "\n  ") << "{\"name\": \"" << corpora[i].name
+              << "\", \"bytes\": " << source.size() << ",\n   \"lex\": ";
+    isolated(source, lex);
+    std::cout << ",\n   \"lex_parse\": ";
+    isolated(source, lex_parse);
+    std::cout << "}";
+  }
+  std::cout << "\n]}" << std::endl;
+  return 0;
+}
+
+// vim:foldmethod=marker
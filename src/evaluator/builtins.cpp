@@ -97,12 +97,12 @@ std::shared_ptr<Object> _puts(std::vector<std::shared_ptr<Object>> args) {
   return null();
 }
 
-std::unordered_map<std::string, std::shared_ptr<Builtin>> builtins =
-    std::unordered_map<std::string, std::shared_ptr<Builtin>>{
-        {"len", std::make_shared<Builtin>(_len)},
-        {"first", std::make_shared<Builtin>(_first)},
-        {"last", std::make_shared<Builtin>(_last)},
-        {"rest", std::make_shared<Builtin>(_rest)},
-        {"push", std::make_shared<Builtin>(_push)},
-        {"puts", std::make_shared<Builtin>(_puts)},
+std::unordered_map<Symbol, std::shared_ptr<Builtin>> builtins =
+    std::unordered_map<Symbol, std::shared_ptr<Builtin>>{
+        {intern("len"), std::make_shared<Builtin>(_len)},
+        {intern("first"), std::make_shared<Builtin>(_first)},
+        {intern("last"), std::make_shared<Builtin>(_last)},
+        {intern("rest"), std::make_shared<Builtin>(_rest)},
+        {intern("push"), std::make_shared<Builtin>(_push)},
+        {intern("puts"), std::make_shared<Builtin>(_puts)},
     };
@@ -3,4 +3,4 @@
 #include <string>
 #include <unordered_map>
 
-extern std::unordered_map<std::string, std::shared_ptr<Builtin>> builtins;
+extern std::unordered_map<Symbol, std::shared_ptr<Builtin>> builtins;
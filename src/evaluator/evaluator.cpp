@@ -1,13 +1,21 @@
 #include "evaluator.hpp"
 #include "builtins.hpp"
+#include "../optimizer/optimizer.hpp"
+#include "../optimizer/resolver.hpp"
 #include <functional>
 
-std::shared_ptr<Null> null() { return std::make_unique<Null>(_NULL); }
+// Objects are never modified once built, so null and the booleans are shared
+std::shared_ptr<Null> null() {
+  static const auto shared{std::make_shared<Null>(_NULL)};
+  return shared;
+}
 std::shared_ptr<Integer> integer(IntType value) {
   return std::make_unique<Integer>(value);
 }
 std::shared_ptr<Boolean> boolean(bool value) {
-  return std::make_unique<Boolean>(value ? _TRUE : _FALSE);
+  static const auto yes{std::make_shared<Boolean>(_TRUE)};
+  static const auto no{std::make_shared<Boolean>(_FALSE)};
+  return value ? yes : no;
 }
 std::shared_ptr<String> string(const std::string &value) {
   return std::make_unique<String>(value);
@@ -18,10 +26,10 @@ std::shared_ptr<ReturnValue> return_value(std::shared_ptr<Object> value) {
 std::shared_ptr<Error> error(std::string message) {
   return std::make_unique<Error>(message);
 }
-std::shared_ptr<Function> function(std::vector<Identifier> params,
-                                   std::shared_ptr<BlockStatement> body,
-                                   std::shared_ptr<Environment> env) {
-  return std::make_unique<Function>(std::move(params), std::move(body), env);
+std::shared_ptr<Function> function(const FunctionLiteral *literal,
+                                   Environment &env) {
+  return std::make_unique<Function>(literal,
+                                    env.capture_for(literal->captures));
 }
 std::shared_ptr<Array> array(std::vector<std::shared_ptr<Object>> elements) {
   return std::make_unique<Array>(elements);
@@ -30,15 +38,13 @@ std::shared_ptr<Hash> hash(std::unordered_map<HashKey, HashPair> pairs) {
   return std::make_unique<Hash>(pairs);
 }
 
-std::shared_ptr<Error> unknown_infix(ObjectType left,
-                                     token_types::TokenVariant oper,
+std::shared_ptr<Error> unknown_infix(ObjectType left, TokenKind oper,
                                      ObjectType right) {
   return error("unknown operator: " + std::to_string(left) + " " +
                literal_string(oper) + " " + std::to_string(right));
 }
 
-std::shared_ptr<Error> unknown_prefix(token_types::TokenVariant oper,
-                                      ObjectType right) {
+std::shared_ptr<Error> unknown_prefix(TokenKind oper, ObjectType right) {
   return error("unknown operator: " + literal_string(oper) +
                std::to_string(right));
 }
@@ -67,116 +73,141 @@ bool is_error(Object *obj) {
   return false;
 }
 
-std::shared_ptr<Object>
-eval_bang_operator_expression(std::shared_ptr<Object> expr) {
-  return boolean(!is_truthy(expr.get()));
-}
+// {{{ Operators
+// Every (opcode, operand types) combination that means something has its own
+// kernel in tables built at compile time. The rest of the table reports the
+// errors the evaluator always has.
+using PrefixFn = std::shared_ptr<Object> (*)(Opcode, Object *);
+using InfixFn = std::shared_ptr<Object> (*)(Object *, Opcode, Object *);
 
-std::shared_ptr<Object>
-eval_minus_operator_expression(std::shared_ptr<Object> expr) {
-  Object *obj{expr.get()};
-  if (obj->type() == ObjectType::INTEGER_OBJ) {
-    return integer(-(static_cast<Integer *>(obj)->value));
-  } else {
-    return unknown_prefix(token_types::Minus{}, obj->type());
-  }
+std::shared_ptr<Object> bang_prefix(Opcode, Object *right) {
+  return boolean(!is_truthy(right));
 }
 
-std::shared_ptr<Object> eval_prefix_expression(token_types::TokenVariant oper,
-                                               std::shared_ptr<Object> right) {
-  std::shared_ptr<Object> ret_val{};
-  if (is_type<token_types::Bang>(oper)) {
-    ret_val = eval_bang_operator_expression(right);
-  } else if (is_type<token_types::Minus>(oper)) {
-    ret_val = eval_minus_operator_expression(right);
-  } else {
-    ret_val = unknown_prefix(oper, right->type());
-  }
+std::shared_ptr<Object> integer_negate(Opcode, Object *right) {
+  return integer(-static_cast<Integer *>(right)->value);
+}
 
-  return ret_val;
+std::shared_ptr<Object> unknown_prefix_fn(Opcode op, Object *right) {
+  return unknown_prefix(opcode_token(op), right->type());
 }
 
-std::shared_ptr<Object>
-eval_integer_infix_expression(std::shared_ptr<Object> left,
-                              const token_types::TokenVariant &oper,
-                              std::shared_ptr<Object> right) {
-  using namespace token_types;
-  auto lhs{static_cast<Integer *>(left.get())->value};
-  auto rhs{static_cast<Integer *>(right.get())->value};
-  if (is_type<Plus>(oper)) {
+template <Opcode op>
+std::shared_ptr<Object> integer_infix(Object *left, Opcode, Object *right) {
+  auto lhs{static_cast<Integer *>(left)->value};
+  auto rhs{static_cast<Integer *>(right)->value};
+  if constexpr (op == Opcode::Add) {
     return integer(lhs + rhs);
-  } else if (is_type<Minus>(oper)) {
+  } else if constexpr (op == Opcode::Sub) {
     return integer(lhs - rhs);
-  } else if (is_type<Asterisk>(oper)) {
+  } else if constexpr (op == Opcode::Mul) {
     return integer(lhs * rhs);
-  } else if (is_type<Slash>(oper)) {
+  } else if constexpr (op == Opcode::Div) {
     return integer(lhs / rhs);
-  } else if (is_type<LT>(oper)) {
+  } else if constexpr (op == Opcode::Lt) {
     return boolean(lhs < rhs);
-  } else if (is_type<GT>(oper)) {
+  } else if constexpr (op == Opcode::Gt) {
     return boolean(lhs > rhs);
-  } else if (is_type<Eq>(oper)) {
+  } else if constexpr (op == Opcode::Eq) {
     return boolean(lhs == rhs);
-  } else if (is_type<NotEq>(oper)) {
-    return boolean(lhs != rhs);
   } else {
-    return unknown_infix(left->type(), oper, right->type());
+    static_assert(op == Opcode::NotEq);
+    return boolean(lhs != rhs);
   }
 }
 
-std::shared_ptr<Object>
-eval_boolean_infix_expression(std::shared_ptr<Object> left,
-                              const token_types::TokenVariant &oper,
-                              std::shared_ptr<Object> right) {
-  auto lhs{static_cast<Boolean *>(left.get())->value};
-  auto rhs{static_cast<Boolean *>(right.get())->value};
-  if (is_type<token_types::Eq>(oper)) {
+template <Opcode op>
+std::shared_ptr<Object> boolean_infix(Object *left, Opcode, Object *right) {
+  auto lhs{static_cast<Boolean *>(left)->value};
+  auto rhs{static_cast<Boolean *>(right)->value};
+  if constexpr (op == Opcode::Eq) {
     return boolean(lhs == rhs);
-  } else if (is_type<token_types::NotEq>(oper)) {
-    return boolean(lhs != rhs);
   } else {
-    return unknown_infix(left->type(), oper, right->type());
+    static_assert(op == Opcode::NotEq);
+    return boolean(lhs != rhs);
   }
 }
 
-std::shared_ptr<Object>
-eval_string_infix_expression(std::shared_ptr<Object> left,
-                             const token_types::TokenVariant &oper,
-                             std::shared_ptr<Object> right) {
-  auto lhs{static_cast<String *>(left.get())->value};
-  auto rhs{static_cast<String *>(right.get())->value};
-  if (is_type<token_types::Plus>(oper)) {
-    return string(lhs + rhs);
-  } else {
-    return unknown_infix(left->type(), oper, right->type());
+std::shared_ptr<Object> string_concat(Object *left, Opcode, Object *right) {
+  return string(static_cast<String *>(left)->value +
+                static_cast<String *>(right)->value);
+}
+
+std::shared_ptr<Object> unknown_infix_fn(Object *left, Opcode op,
+                                         Object *right) {
+  return unknown_infix(left->type(), opcode_token(op), right->type());
+}
+
+std::shared_ptr<Object> type_mismatch(Object *left, Opcode op,
+                                      Object *right) {
+  return error("type mismatch: " + std::to_string(left->type()) + " " +
+               literal_string(opcode_token(op)) + " " +
+               std::to_string(right->type()));
+}
+
+struct OperatorTables {
+  PrefixFn prefix[OPCODE_COUNT][OBJECT_TYPE_COUNT]{};
+  InfixFn infix[OPCODE_COUNT][OBJECT_TYPE_COUNT][OBJECT_TYPE_COUNT]{};
+};
+
+constexpr OperatorTables make_operator_tables() {
+  OperatorTables t{};
+  for (size_t op = 0; op < OPCODE_COUNT; ++op) {
+    for (size_t l = 0; l < OBJECT_TYPE_COUNT; ++l) {
+      t.prefix[op][l] = unknown_prefix_fn;
+      for (size_t r = 0; r < OBJECT_TYPE_COUNT; ++r) {
+        t.infix[op][l][r] = l == r ? unknown_infix_fn : type_mismatch;
+      }
+    }
+  }
+  auto infix{[&t](Opcode op, ObjectType type, InfixFn fn) {
+    t.infix[static_cast<size_t>(op)][static_cast<size_t>(type)]
+           [static_cast<size_t>(type)] = fn;
+  }};
+
+  for (auto &fn : t.prefix[static_cast<size_t>(Opcode::Not)]) {
+    fn = bang_prefix;
   }
+  t.prefix[static_cast<size_t>(Opcode::Neg)]
+          [static_cast<size_t>(ObjectType::INTEGER_OBJ)] = integer_negate;
+
+  auto integers{ObjectType::INTEGER_OBJ};
+  infix(Opcode::Add, integers, integer_infix<Opcode::Add>);
+  infix(Opcode::Sub, integers, integer_infix<Opcode::Sub>);
+  infix(Opcode::Mul, integers, integer_infix<Opcode::Mul>);
+  infix(Opcode::Div, integers, integer_infix<Opcode::Div>);
+  infix(Opcode::Lt, integers, integer_infix<Opcode::Lt>);
+  infix(Opcode::Gt, integers, integer_infix<Opcode::Gt>);
+  infix(Opcode::Eq, integers, integer_infix<Opcode::Eq>);
+  infix(Opcode::NotEq, integers, integer_infix<Opcode::NotEq>);
+  infix(Opcode::Eq, ObjectType::BOOLEAN_OBJ, boolean_infix<Opcode::Eq>);
+  infix(Opcode::NotEq, ObjectType::BOOLEAN_OBJ, boolean_infix<Opcode::NotEq>);
+  infix(Opcode::Add, ObjectType::STRING_OBJ, string_concat);
+  return t;
+}
+
+constexpr OperatorTables operators{make_operator_tables()};
+
+std::shared_ptr<Object> eval_prefix_expression(Opcode op,
+                                               std::shared_ptr<Object> right) {
+  return operators.prefix[static_cast<size_t>(op)]
+                         [static_cast<size_t>(right->type())](op, right.get());
 }
 
 std::shared_ptr<Object>
-eval_infix_expression(std::shared_ptr<Object> left,
-                      const token_types::TokenVariant &oper,
+eval_infix_expression(std::shared_ptr<Object> left, Opcode op,
                       std::shared_ptr<Object> right) {
-  if (left->type() == ObjectType::INTEGER_OBJ &&
-      right->type() == ObjectType::INTEGER_OBJ) {
-    return eval_integer_infix_expression(left, oper, right);
-  } else if (left->type() == ObjectType::BOOLEAN_OBJ &&
-             right->type() == ObjectType::BOOLEAN_OBJ) {
-    return eval_boolean_infix_expression(left, oper, right);
-  } else if (left->type() == ObjectType::STRING_OBJ &&
-             right->type() == ObjectType::STRING_OBJ) {
-    return eval_string_infix_expression(left, oper, right);
-  } else if (left->type() != right->type()) {
-    return error("type mismatch: " + std::to_string(left->type()) + " " +
-                 literal_string(oper) + " " + std::to_string(right->type()));
-  } else {
-    return unknown_infix(left->type(), oper, right->type());
-  }
+  auto fn{operators.infix[static_cast<size_t>(op)]
+                         [static_cast<size_t>(left->type())]
+                         [static_cast<size_t>(right->type())]};
+  return fn(left.get(), op, right.get());
 }
+// }}}
 
 std::shared_ptr<Object>
 eval_array_index_expression(std::shared_ptr<Object> array,
                             std::shared_ptr<Object> index) {
-  auto arr{static_cast<Array *>(array.get())->elements};
+  auto &arr{static_cast<Array *>(array.get())->elements};
   auto max_idx{(IntType)arr.size() - 1};
   auto idx{static_cast<Integer *>(index.get())->value};
 
@@ -190,18 +221,18 @@ eval_array_index_expression(std::shared_ptr<Object> array,
 std::shared_ptr<Object>
 eval_hash_index_expression(std::shared_ptr<Object> hash,
                            std::shared_ptr<Object> index) {
-  auto pairs{static_cast<Hash *>(hash.get())->pairs};
+  auto &pairs{static_cast<Hash *>(hash.get())->pairs};
   auto key{std::dynamic_pointer_cast<Hashable>(index)};
   if (!key) {
     return unusable_hash(index->type());
   }
 
-  auto hash_key{key->hash_key()};
-  if (!pairs.contains(hash_key)) {
+  auto pair{pairs.find(key->hash_key())};
+  if (pair == pairs.end()) {
     return null();
   }
 
-  return pairs[hash_key].value;
+  return pair->second.value;
 }
 
 std::shared_ptr<Object> eval_index_expression(std::shared_ptr<Object> left,
@@ -218,9 +249,8 @@ std::shared_ptr<Object> eval_index_expression(std::shared_ptr<Object> left,
 }
 
 std::shared_ptr<Object>
-eval_if_expression(std::shared_ptr<Expression> condition,
-                   std::shared_ptr<BlockStatement> consequence,
-                   std::shared_ptr<BlockStatement> alternative,
+eval_if_expression(Expression *condition, BlockStatement *consequence,
+                   BlockStatement *alternative,
                    std::shared_ptr<Environment> env) {
   auto cond{eval(condition, env)};
   if (is_error(cond.get())) {
@@ -236,7 +266,7 @@ eval_if_expression(std::shared_ptr<Expression> condition,
 }
 
 std::shared_ptr<Object>
-eval_program(std::vector<std::shared_ptr<Statement>> statements,
+eval_program(std::span<Statement *const> statements,
              std::shared_ptr<Environment> env) {
   std::shared_ptr<Object> result{};
   for (auto &s : statements) {
@@ -251,7 +281,7 @@ eval_program(std::vector<std::shared_ptr<Statement>> statements,
 }
 
 std::shared_ptr<Object>
-eval_block_statement(std::vector<std::shared_ptr<Statement>> statements,
+eval_block_statement(std::span<Statement *const> statements,
                      std::shared_ptr<Environment> env) {
   std::shared_ptr<Object> result{};
   for (auto &s : statements) {
@@ -267,19 +297,40 @@ eval_block_statement(std::vector<std::shared_ptr<Statement>> statements,
   return result;
 }
 
-std::shared_ptr<Object> eval_identifier(const std::string &name,
-                                        std::shared_ptr<Environment> env) {
-  auto val{env->get(name)};
-  if (val) {
+std::shared_ptr<Object> eval_identifier(const Identifier &ident,
+                                        Environment &env) {
+  switch (ident.binding) {
+  case Identifier::Binding::Local:
+    if (auto &val{env.slot(ident.slot)}) {
+      return val;
+    }
+    break;
+  case Identifier::Binding::Cell:
+    if (auto &val{env.read_cell(ident.slot)}) {
+      return val;
+    }
+    break;
+  case Identifier::Binding::Capture:
+    if (auto &val{env.capture(ident.slot)}) {
+      return val;
+    }
+    break;
+  case Identifier::Binding::Global:
+    break;
+  }
+  // Unassigned locals that shadow no enclosing variable fall back to
+  // globals, like names that were never resolved
+  if (auto val{env.get(ident.symbol)}) {
     return val;
   }
-  if (builtins.contains(name)) {
-    return builtins[name];
+  auto builtin{builtins.find(ident.symbol)};
+  if (builtin != builtins.end()) {
+    return builtin->second;
   }
-  return error("identifier not found: " + name);
+  return error("identifier not found: " + ident.to_string());
 }
 std::vector<std::shared_ptr<Object>>
-eval_expressions(std::vector<std::shared_ptr<Expression>> expressions,
+eval_expressions(std::span<Expression *const> expressions,
                  std::shared_ptr<Environment> env) {
   std::vector<std::shared_ptr<Object>> args{};
   for (size_t i = 0; i < expressions.size(); i++) {
@@ -292,32 +343,72 @@ eval_expressions(std::vector<std::shared_ptr<Expression>> expressions,
   return args;
 }
 
+std::shared_ptr<Object> &local(Environment &env, const Identifier &ident) {
+  return ident.binding == Identifier::Binding::Cell ? env.cell(ident.slot)
+                                                    : env.slot(ident.slot);
+}
+
 std::shared_ptr<Environment>
 extend_function_env(std::shared_ptr<Function> func,
-                    std::vector<std::shared_ptr<Object>> args) {
-  auto extended{std::make_shared<Environment>(func->env)};
-  for (size_t i = 0; i < args.size(); i++) {
-    extended->set(func->params[i].value, args[i]);
+                    std::vector<std::shared_ptr<Object>> args,
+                    std::shared_ptr<Environment> globals) {
+  auto extended{std::make_shared<Environment>(std::move(globals), func)};
+  for (size_t i = 0; i < args.size() && i < func->params.size(); i++) {
+    local(*extended, func->params[i]) = args[i];
   }
   return extended;
 }
 
 std::shared_ptr<Object> unwrap_return_value(std::shared_ptr<Object> obj) {
-  if (obj->type() == ObjectType::RETURN_VALUE_OBJ) {
+  if (obj && obj->type() == ObjectType::RETURN_VALUE_OBJ) {
     return std::static_pointer_cast<ReturnValue>(obj)->value;
   }
   return obj;
 }
 
+// Parses, folds and resolves the body on the first call. Null once
+// `function->literal->body()` is ready to run.
+std::shared_ptr<Error> prepare_body(const Function &function) {
+  auto *literal{function.literal};
+  auto fresh{!literal->body_parsed()};
+  auto *body{literal->body()};
+  if (!body) {
+    return error("could not parse function body: " +
+                 std::string{literal->body_error()});
+  }
+  // Lazily parsed bodies missed the passes the rest of the program got
+  if (fresh) {
+    fold_constants(*body, *literal->arena);
+  }
+  if (!literal->resolved) {
+    resolve(*const_cast<FunctionLiteral *>(literal));
+  }
+  return nullptr;
+}
+
 std::shared_ptr<Object>
 apply_function(std::shared_ptr<Object> obj,
-               std::vector<std::shared_ptr<Object>> args) {
+               std::vector<std::shared_ptr<Object>> args,
+               const std::shared_ptr<Environment> &env) {
   if (obj->type() == ObjectType::FUNCTION_OBJ) {
     auto function{std::static_pointer_cast<Function>(obj)};
-    auto extended_env{extend_function_env(function, args)};
-    auto evaluated{
-        eval_block_statement(function->body->statements, extended_env)};
-    return unwrap_return_value(evaluated);
+    auto &globals{env->globals(env)};
+    // Tail calls come back here instead of nesting another call
+    for (;;) {
+      if (auto err{prepare_body(*function)}) {
+        return err;
+      }
+      auto *body{function->literal->body()};
+      auto extended_env{extend_function_env(function, args, globals)};
+      auto evaluated{unwrap_return_value(
+          eval_block_statement(body->statements, extended_env))};
+      if (!evaluated || evaluated->type() != ObjectType::TAIL_CALL_OBJ) {
+        return evaluated;
+      }
+      auto *call{static_cast<TailCall *>(evaluated.get())};
+      function = std::move(call->function);
+      args = std::move(call->args);
+    }
   } else if (obj->type() == ObjectType::BUILTIN_OBJ) {
     auto function{std::static_pointer_cast<Builtin>(obj)};
     return function->fn(args);
@@ -326,10 +417,9 @@ apply_function(std::shared_ptr<Object> obj,
   return error("not a function: " + std::to_string(obj->type()));
 }
 
-std::shared_ptr<Object> eval_hash_literal(
-    std::unordered_map<std::shared_ptr<Expression>, std::shared_ptr<Expression>>
-        node_pairs,
-    std::shared_ptr<Environment> env) {
+std::shared_ptr<Object>
+eval_hash_literal(std::span<const HashLiteral::Pair> node_pairs,
+                  std::shared_ptr<Environment> env) {
   std::unordered_map<HashKey, HashPair> pairs{};
   for (const auto &k : node_pairs) {
     auto key{eval(k.first, env)};
@@ -350,37 +440,229 @@ std::shared_ptr<Object> eval_hash_literal(
   return hash(pairs);
 }
 
-std::shared_ptr<Object> eval(std::shared_ptr<Node> node,
-                             std::shared_ptr<Environment> env) {
-  Node *n = node.get();
-  if (auto *p = dynamic_cast<Program *>(n)) {
-    return eval_program(p->statements, env);
-  } else if (auto *e{dynamic_cast<ReturnStatement *>(n)}) {
-    auto val{eval(e->value, env)};
-    if (is_error(val.get())) {
-      return val;
+bool is_leaf(NodeKind kind) {
+  switch (kind) {
+  case NodeKind::Identifier:
+  case NodeKind::IntegerLiteral:
+  case NodeKind::BooleanLiteral:
+  case NodeKind::StringLiteral:
+  case NodeKind::FunctionLiteral:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Nodes without children to evaluate
+std::shared_ptr<Object> eval_leaf(Node *n, Environment &env) {
+  switch (n->kind) {
+  case NodeKind::Identifier:
+    return eval_identifier(*static_cast<Identifier *>(n), env);
+  case NodeKind::IntegerLiteral: {
+    auto *e{static_cast<IntegerLiteral *>(n)};
+    if (!e->constant) {
+      e->constant = integer(e->value);
     }
-    return return_value(val);
-  } else if (auto *e{dynamic_cast<ExpressionStatement *>(n)}) {
-    return eval(e->value, env);
-  } else if (auto *e{dynamic_cast<LetStatement *>(n)}) {
-    auto val{eval(e->value, env)};
-    if (is_error(val.get())) {
-      return val;
+    return e->constant;
+  }
+  case NodeKind::BooleanLiteral:
+    return boolean(static_cast<BooleanLiteral *>(n)->value);
+  case NodeKind::StringLiteral: {
+    auto *e{static_cast<StringLiteral *>(n)};
+    if (!e->constant) {
+      e->constant = string(std::string{e->value});
+    }
+    return e->constant;
+  }
+  case NodeKind::FunctionLiteral:
+    return function(static_cast<FunctionLiteral *>(n), env);
+  default:
+    return nullptr;
+  }
+}
+
+// {{{ Quickening
+// Operator and call nodes rewrite their kind to a specialized form once they
+// have seen what they work on. Each form checks that it still applies, and
+// goes back to the generic kind and path if not.
+std::shared_ptr<Object> integer_operation(Opcode op, IntType lhs,
+                                          IntType rhs) {
+  switch (op) {
+  case Opcode::Add:
+    return integer(lhs + rhs);
+  case Opcode::Sub:
+    return integer(lhs - rhs);
+  case Opcode::Mul:
+    return integer(lhs * rhs);
+  case Opcode::Div:
+    return integer(lhs / rhs);
+  case Opcode::Lt:
+    return boolean(lhs < rhs);
+  case Opcode::Gt:
+    return boolean(lhs > rhs);
+  case Opcode::Eq:
+    return boolean(lhs == rhs);
+  case Opcode::NotEq:
+    return boolean(lhs != rhs);
+  default:
+    return nullptr;
+  }
+}
+
+// For every kind of infix node, once its operands are evaluated
+std::shared_ptr<Object> eval_infix_node(InfixExpression *e,
+                                        const std::shared_ptr<Object> &left,
+                                        const std::shared_ptr<Object> &right) {
+  if (left->type() == ObjectType::INTEGER_OBJ &&
+      right->type() == ObjectType::INTEGER_OBJ && e->opcode < Opcode::Not) {
+    if (e->kind == NodeKind::InfixExpression) {
+      e->kind = e->right->kind == NodeKind::IntegerLiteral
+                    ? NodeKind::IntegerConstantInfix
+                    : NodeKind::IntegerInfix;
+    }
+    return integer_operation(e->opcode,
+                             static_cast<Integer *>(left.get())->value,
+                             static_cast<Integer *>(right.get())->value);
+  }
+  e->kind = NodeKind::InfixExpression;
+  return eval_infix_expression(left, e->opcode, right);
+}
+
+// IntegerConstantInfix only evaluates its left side
+std::shared_ptr<Object>
+eval_integer_constant_infix(InfixExpression *e,
+                            const std::shared_ptr<Object> &left,
+                            Environment &env) {
+  if (left->type() == ObjectType::INTEGER_OBJ) {
+    return integer_operation(e->opcode,
+                             static_cast<Integer *>(left.get())->value,
+                             static_cast<IntegerLiteral *>(e->right)->value);
+  }
+  return eval_infix_node(e, left, eval_leaf(e->right, env));
+}
+
+std::shared_ptr<Object> eval_index_node(IndexExpression *e,
+                                        const std::shared_ptr<Object> &left,
+                                        const std::shared_ptr<Object> &index) {
+  if (left->type() == ObjectType::ARRAY_OBJ &&
+      index->type() == ObjectType::INTEGER_OBJ) {
+    e->kind = NodeKind::ArrayIndex;
+    auto &elements{static_cast<Array *>(left.get())->elements};
+    auto i{static_cast<Integer *>(index.get())->value};
+    if (i < 0 || i >= static_cast<IntType>(elements.size())) {
+      return null();
+    }
+    return elements[i];
+  }
+  e->kind = NodeKind::IndexExpression;
+  return eval_index_expression(left, index);
+}
+
+// Calls of a function found in a global skip looking it up again, for as
+// long as they run in the same global environment
+void quicken_call(CallExpression *e, const std::shared_ptr<Object> &callee,
+                  Environment &globals) {
+  if (callee->type() != ObjectType::FUNCTION_OBJ ||
+      e->function->kind != NodeKind::Identifier) {
+    return;
+  }
+  auto *ident{static_cast<Identifier *>(e->function)};
+  if (ident->binding != Identifier::Binding::Global) {
+    return;
+  }
+  if (auto *global{globals.find(ident->symbol)}; global && *global == callee) {
+    e->kind = NodeKind::GlobalCall;
+    e->globals_id = globals.id();
+    e->global = global;
+  }
+}
+
+// The cached global if it still applies. Null otherwise, after going back to
+// a generic call.
+std::shared_ptr<Object> *global_callee(CallExpression *e,
+                                       Environment &globals) {
+  if (e->kind != NodeKind::GlobalCall) {
+    return nullptr;
+  } else if (e->globals_id == globals.id()) {
+    return e->global;
+  }
+  e->kind = NodeKind::CallExpression;
+  return nullptr;
+}
+// }}}
+
+std::shared_ptr<Object> eval(Node *n, std::shared_ptr<Environment> env) {
+  if (!n) {
+    return nullptr;
+  }
+  switch (n->kind) {
+  case NodeKind::Identifier:
+  case NodeKind::IntegerLiteral:
+  case NodeKind::BooleanLiteral:
+  case NodeKind::StringLiteral:
+  case NodeKind::FunctionLiteral:
+    return eval_leaf(n, *env);
+  case NodeKind::InfixExpression:
+  case NodeKind::IntegerInfix: {
+    auto *e{static_cast<InfixExpression *>(n)};
+    auto left{eval(e->left, env)};
+    if (is_error(left.get())) {
+      return left;
+    }
+    auto right{eval(e->right, env)};
+    if (is_error(right.get())) {
+      return right;
+    }
+    return eval_infix_node(e, left, right);
+  }
+  case NodeKind::IntegerConstantInfix: {
+    auto *e{static_cast<InfixExpression *>(n)};
+    auto left{eval(e->left, env)};
+    if (is_error(left.get())) {
+      return left;
+    }
+    return eval_integer_constant_infix(e, left, *env);
+  }
+  case NodeKind::CallExpression:
+  case NodeKind::GlobalCall: {
+    auto *e{static_cast<CallExpression *>(n)};
+    auto &globals{env->globals(env)};
+    std::shared_ptr<Object> val{};
+    if (auto *global{global_callee(e, *globals)}) {
+      val = *global;
+    } else {
+      val = eval(e->function, env);
+      if (is_error(val.get())) {
+        return val;
+      }
+      quicken_call(e, val, *globals);
+    }
+    auto args{eval_expressions(e->arguments, env)};
+    if (args.size() == 1 && is_error(args[0].get())) {
+      return args[0];
+    }
+    if (e->tail && val->type() == ObjectType::FUNCTION_OBJ) {
+      return std::make_shared<TailCall>(std::static_pointer_cast<Function>(val),
+                                        std::move(args));
     }
-    return env->set(std::move(e->identifier.value), std::move(val));
-  } else if (auto *b{dynamic_cast<BlockStatement *>(n)}) {
-    return eval_block_statement(b->statements, env);
-  } else if (auto *i{dynamic_cast<IfExpression *>(n)}) {
+    return apply_function(val, args, env);
+  }
+  case NodeKind::IfExpression: {
+    auto *i{static_cast<IfExpression *>(n)};
     return eval_if_expression(i->condition, i->consequence, i->alternative,
                               env);
-  } else if (auto *e{dynamic_cast<PrefixExpression *>(n)}) {
+  }
+  case NodeKind::PrefixExpression: {
+    auto *e{static_cast<PrefixExpression *>(n)};
     auto val{eval(e->right, env)};
     if (is_error(val.get())) {
       return val;
     }
-    return eval_prefix_expression(e->oper, val);
-  } else if (auto *e{dynamic_cast<IndexExpression *>(n)}) {
+    return eval_prefix_expression(e->opcode, val);
+  }
+  case NodeKind::IndexExpression:
+  case NodeKind::ArrayIndex: {
+    auto *e{static_cast<IndexExpression *>(n)};
     auto left{eval(e->left, env)};
     if (is_error(left.get())) {
       return left;
@@ -389,48 +671,363 @@ std::shared_ptr<Object> eval(std::shared_ptr<Node> node,
     if (is_error(index.get())) {
       return index;
     }
-    return eval_index_expression(left, index);
-  } else if (auto *a{dynamic_cast<ArrayLiteral *>(n)}) {
-    auto elements{eval_expressions(a->elements, env)};
+    return eval_index_node(e, left, index);
+  }
+  case NodeKind::ArrayLiteral: {
+    auto elements{eval_expressions(static_cast<ArrayLiteral *>(n)->elements,
+                                   env)};
     if (elements.size() == 1 && is_error(elements[0].get())) {
       return elements[0];
     }
     return array(elements);
-  } else if (auto *a{dynamic_cast<HashLiteral *>(n)}) {
-    return eval_hash_literal(a->pairs, env);
-  } else if (auto *e{dynamic_cast<CallExpression *>(n)}) {
-    auto val{eval(e->function, env)};
+  }
+  case NodeKind::HashLiteral:
+    return eval_hash_literal(static_cast<HashLiteral *>(n)->pairs, env);
+  case NodeKind::Program:
+    return eval_program(static_cast<Program *>(n)->statements, env);
+  case NodeKind::ExpressionStatement:
+    return eval(static_cast<ExpressionStatement *>(n)->value, env);
+  case NodeKind::ReturnStatement: {
+    auto val{eval(static_cast<ReturnStatement *>(n)->value, env)};
     if (is_error(val.get())) {
       return val;
     }
-    auto args{eval_expressions(e->arguments, env)};
-    if (args.size() == 1 && is_error(args[0].get())) {
-      return args[0];
+    return return_value(val);
+  }
+  case NodeKind::LetStatement: {
+    auto *e{static_cast<LetStatement *>(n)};
+    auto val{eval(e->value, env)};
+    if (is_error(val.get())) {
+      return val;
     }
-    return apply_function(val, args);
-  } else if (auto *e{dynamic_cast<InfixExpression *>(n)}) {
-    auto left{eval(e->left, env)};
-    if (is_error(left.get())) {
-      return left;
+    if (e->identifier.binding == Identifier::Binding::Global) {
+      return env->set(e->identifier.symbol, std::move(val));
     }
-    auto right{eval(e->right, env)};
-    if (is_error(right.get())) {
-      return right;
+    auto &slot{local(*env, e->identifier)};
+    slot = std::move(val);
+    return slot;
+  }
+  case NodeKind::BlockStatement:
+    return eval_block_statement(static_cast<BlockStatement *>(n)->statements,
+                                env);
+  }
+  return nullptr;
+}
+
+// {{{ Explicit stack
+// The same evaluation as eval(), as a loop over heap-allocated stacks: one
+// task per node being evaluated, the values its children produced, and the
+// environments of the calls in progress. Every node gets the same checks in
+// the same order as in eval(), so results and errors match.
+namespace {
+struct Task {
+  Node *node;
+  // How many children have been evaluated, or RUNNING for a call whose body
+  // is being evaluated
+  uint32_t step;
+  // Where the task's values start
+  size_t base;
+};
+
+constexpr uint32_t RUNNING{UINT32_MAX};
+
+class Machine {
+public:
+  Machine(std::shared_ptr<Environment> env, size_t max_depth)
+      : globals(env->globals(env)), max_depth(max_depth) {
+    envs.push_back(std::move(env));
+  }
+  std::shared_ptr<Object> run(Node *);
+
+private:
+  // Leaves are evaluated on the spot, the rest get a task
+  void push(Node *n) {
+    if (n && is_leaf(n->kind)) {
+      values.push_back(eval_leaf(n, *envs.back()));
+    } else if (n && n->kind == NodeKind::ExpressionStatement) {
+      push(static_cast<ExpressionStatement *>(n)->value);
+    } else {
+      tasks.push_back({n, 0, values.size()});
     }
-    return eval_infix_expression(left, e->oper, right);
-  } else if (auto *f{dynamic_cast<FunctionLiteral *>(n)}) {
-    return function(std::move(f->params), std::move(f->body), env);
-  } else if (auto *e{dynamic_cast<IntegerLiteral *>(n)}) {
-    return integer(e->value);
-  } else if (auto *b{dynamic_cast<BooleanLiteral *>(n)}) {
-    return boolean(b->value);
-  } else if (auto *s{dynamic_cast<StringLiteral *>(n)}) {
-    return string(s->value);
-  } else if (auto *b{dynamic_cast<Identifier *>(n)}) {
-    return eval_identifier(b->value, env);
-  } else {
-    return nullptr;
   }
+  // Pops the top task, leaving `value` as its result
+  void finish(std::shared_ptr<Object> value) {
+    values.resize(tasks.back().base);
+    values.push_back(std::move(value));
+    tasks.pop_back();
+  }
+  // Finishes with the error on top of `values` if there is one
+  bool failed() {
+    if (!is_error(values.back().get())) {
+      return false;
+    }
+    finish(values.back());
+    return true;
+  }
+  // Evaluates `expressions` one after the other into `values`, offset by
+  // `first` steps. False while there are more to go, or if one failed.
+  bool expressions(Task &task, std::span<Expression *const> expressions,
+                   uint32_t first);
+  void statements(Task &task, std::span<Statement *const> statements,
+                  bool program);
+  void call(Task &task);
+  void enter(std::shared_ptr<Function> function,
+             std::vector<std::shared_ptr<Object>> args);
+
+  std::vector<Task> tasks{};
+  std::vector<std::shared_ptr<Object>> values{};
+  std::vector<std::shared_ptr<Environment>> envs{};
+  std::shared_ptr<Environment> globals;
+  size_t max_depth;
+};
+
+bool Machine::expressions(Task &task, std::span<Expression *const> exprs,
+                          uint32_t first) {
+  auto done{task.step - first};
+  if (done > 0 && failed()) {
+    return false;
+  }
+  if (done == exprs.size()) {
+    return true;
+  }
+  ++task.step;
+  push(exprs[done]);
+  return false;
+}
+
+void Machine::statements(Task &task, std::span<Statement *const> stmts,
+                         bool program) {
+  if (task.step > 0) {
+    auto &result{values.back()};
+    if (result && result->type() == ObjectType::ERROR_OBJ) {
+      return finish(result);
+    } else if (result && result->type() == ObjectType::RETURN_VALUE_OBJ) {
+      return finish(program ? unwrap_return_value(result) : result);
+    } else if (task.step == stmts.size()) {
+      return finish(result);
+    }
+    values.pop_back();
+  } else if (stmts.empty()) {
+    return finish(nullptr);
+  }
+  push(stmts[task.step++]);
+}
+
+void Machine::call(Task &task) {
+  auto *e{static_cast<CallExpression *>(task.node)};
+  if (task.step == RUNNING) {
+    auto result{unwrap_return_value(values.back())};
+    if (result && result->type() == ObjectType::TAIL_CALL_OBJ) {
+      auto *tail{static_cast<TailCall *>(result.get())};
+      values.resize(task.base);
+      envs.pop_back();
+      return enter(std::move(tail->function), std::move(tail->args));
+    }
+    envs.pop_back();
+    return finish(result);
+  }
+  if (task.step == 0) {
+    ++task.step;
+    if (auto *global{global_callee(e, *globals)}) {
+      return values.push_back(*global);
+    }
+    return push(e->function);
+  }
+  if (task.step == 1) {
+    if (failed()) {
+      return;
+    }
+    if (e->kind == NodeKind::CallExpression) {
+      quicken_call(e, values.back(), *globals);
+    }
+  }
+  if (!expressions(task, e->arguments, 1)) {
+    return;
+  }
+
+  auto callee{values[task.base]};
+  std::vector<std::shared_ptr<Object>> args(values.begin() + task.base + 1,
+                                            values.end());
+  if (callee->type() == ObjectType::FUNCTION_OBJ) {
+    auto function{std::static_pointer_cast<Function>(callee)};
+    if (e->tail) {
+      return finish(std::make_shared<TailCall>(function, std::move(args)));
+    }
+    values.resize(task.base);
+    return enter(std::move(function), std::move(args));
+  }
+  finish(apply_function(callee, std::move(args), envs.back()));
+}
+
+// Starts running `function` for the call task on top
+void Machine::enter(std::shared_ptr<Function> function,
+                    std::vector<std::shared_ptr<Object>> args) {
+  if (auto err{prepare_body(*function)}) {
+    return finish(err);
+  }
+  // The global scope doesn't count
+  if (envs.size() > max_depth) {
+    return finish(error("stack depth exceeded"));
+  }
+  auto *body{function->literal->body()};
+  envs.push_back(extend_function_env(function, std::move(args), globals));
+  values.push_back(std::move(function));
+  tasks.back().step = RUNNING;
+  push(body);
+}
+
+std::shared_ptr<Object> Machine::run(Node *root) {
+  push(root);
+  while (!tasks.empty()) {
+    auto &task{tasks.back()};
+    auto *n{task.node};
+    if (!n) {
+      finish(nullptr);
+      continue;
+    }
+    auto &env{envs.back()};
+    switch (n->kind) {
+    case NodeKind::Identifier:
+    case NodeKind::IntegerLiteral:
+    case NodeKind::BooleanLiteral:
+    case NodeKind::StringLiteral:
+    case NodeKind::FunctionLiteral:
+      // Only the root, push() evaluates the rest
+      finish(eval_leaf(n, *env));
+      break;
+    case NodeKind::PrefixExpression: {
+      auto *e{static_cast<PrefixExpression *>(n)};
+      if (task.step++ == 0) {
+        push(e->right);
+      } else if (!failed()) {
+        finish(eval_prefix_expression(e->opcode, values.back()));
+      }
+      break;
+    }
+    case NodeKind::InfixExpression:
+    case NodeKind::IntegerInfix: {
+      auto *e{static_cast<InfixExpression *>(n)};
+      Expression *operands[]{e->left, e->right};
+      if (expressions(task, operands, 0)) {
+        finish(eval_infix_node(e, values[task.base], values[task.base + 1]));
+      }
+      break;
+    }
+    case NodeKind::IntegerConstantInfix: {
+      auto *e{static_cast<InfixExpression *>(n)};
+      if (task.step++ == 0) {
+        push(e->left);
+      } else if (!failed()) {
+        finish(eval_integer_constant_infix(e, values.back(), *env));
+      }
+      break;
+    }
+    case NodeKind::IndexExpression:
+    case NodeKind::ArrayIndex: {
+      auto *e{static_cast<IndexExpression *>(n)};
+      Expression *operands[]{e->left, e->index};
+      if (expressions(task, operands, 0)) {
+        finish(eval_index_node(e, values[task.base], values[task.base + 1]));
+      }
+      break;
+    }
+    case NodeKind::CallExpression:
+    case NodeKind::GlobalCall:
+      call(task);
+      break;
+    case NodeKind::IfExpression: {
+      auto *e{static_cast<IfExpression *>(n)};
+      if (task.step++ == 0) {
+        push(e->condition);
+      } else if (!failed()) {
+        // The branch's value is the if's, so it takes over the task
+        auto *branch{is_truthy(values.back().get()) ? e->consequence
+                                                    : e->alternative};
+        values.resize(task.base);
+        if (branch) {
+          task = {branch, 0, task.base};
+        } else {
+          finish(null());
+        }
+      }
+      break;
+    }
+    case NodeKind::ArrayLiteral:
+      if (expressions(task, static_cast<ArrayLiteral *>(n)->elements, 0)) {
+        finish(array(std::vector<std::shared_ptr<Object>>{
+            values.begin() + task.base, values.end()}));
+      }
+      break;
+    case NodeKind::HashLiteral: {
+      auto pairs{static_cast<HashLiteral *>(n)->pairs};
+      auto done{task.step};
+      if (done > 0 && failed()) {
+        break;
+      } else if (done % 2 == 1 &&
+                 !dynamic_cast<Hashable *>(values.back().get())) {
+        finish(unusable_hash(values.back()->type()));
+        break;
+      } else if (done == pairs.size() * 2) {
+        std::unordered_map<HashKey, HashPair> out{};
+        for (size_t i = task.base; i < values.size(); i += 2) {
+          auto key{dynamic_cast<Hashable *>(values[i].get())->hash_key()};
+          out[key] = HashPair{values[i], values[i + 1]};
+        }
+        finish(hash(out));
+        break;
+      }
+      ++task.step;
+      push(done % 2 ? pairs[done / 2].second : pairs[done / 2].first);
+      break;
+    }
+    case NodeKind::Program:
+      statements(task, static_cast<Program *>(n)->statements, true);
+      break;
+    case NodeKind::BlockStatement:
+      statements(task, static_cast<BlockStatement *>(n)->statements, false);
+      break;
+    case NodeKind::ExpressionStatement:
+      // Only the root, push() goes straight to the expression
+      if (task.step++ == 0) {
+        push(static_cast<ExpressionStatement *>(n)->value);
+      } else {
+        finish(values.back());
+      }
+      break;
+    case NodeKind::ReturnStatement:
+      if (task.step++ == 0) {
+        push(static_cast<ReturnStatement *>(n)->value);
+      } else if (!failed()) {
+        finish(return_value(values.back()));
+      }
+      break;
+    case NodeKind::LetStatement: {
+      auto *e{static_cast<LetStatement *>(n)};
+      if (task.step++ == 0) {
+        push(e->value);
+      } else if (!failed()) {
+        auto val{values.back()};
+        if (e->identifier.binding == Identifier::Binding::Global) {
+          finish(env->set(e->identifier.symbol, std::move(val)));
+        } else {
+          auto &slot{local(*env, e->identifier)};
+          slot = std::move(val);
+          finish(slot);
+        }
+      }
+      break;
+    }
+    }
+  }
+  return values.back();
+}
+} // namespace
+
+std::shared_ptr<Object> eval_explicit_stack(Node *n,
+                                            std::shared_ptr<Environment> env,
+                                            size_t max_depth) {
+  return Machine{std::move(env), max_depth}.run(n);
 }
+// }}}
 
 // vim:foldmethod=marker
@@ -16,5 +16,13 @@ std::shared_ptr<Integer> integer(IntType value);
 std::shared_ptr<String> string(const std::string &value);
 std::shared_ptr<Boolean> boolean(bool value);
 
-std::shared_ptr<Object> eval(std::shared_ptr<Node>,
-                             std::shared_ptr<Environment>);
+std::shared_ptr<Object> eval(Node *, std::shared_ptr<Environment>);
+
+// Call depth at which eval_explicit_stack() gives up by default
+inline constexpr size_t DEFAULT_MAX_DEPTH{1'000'000};
+// Like eval(), but Monkey calls and pending operands are kept on heap stacks
+// instead of the C++ one, so deep recursion is bounded by memory. Calls
+// nested deeper than `max_depth` fail with "stack depth exceeded".
+std::shared_ptr<Object>
+eval_explicit_stack(Node *, std::shared_ptr<Environment>,
+                    size_t max_depth = DEFAULT_MAX_DEPTH);
@@ -1,9 +1,25 @@
 #include "lexer.hpp"
+#include "scan.hpp"
+#include <algorithm>
+#include <array>
+#include <charconv>
 #include <string>
+#include <thread>
+#include <vector>
 
-Lexer::Lexer(std::string input) : input{input} { read_char(); };
+Lexer::Lexer(std::string input)
+    : Lexer(Source::from_string(std::move(input))) {}
 
-Token new_token(token_types::TokenVariant t) { return Token{t}; }
+Lexer::Lexer(std::shared_ptr<const Source> s) : Lexer(s, s->view()) {}
+
+Lexer::Lexer(std::shared_ptr<const Source> s, std::string_view input)
+    : source{std::move(s)}, input{input} {
+  read_char();
+}
+
+Lexer Lexer::borrow(std::string_view input) { return Lexer{nullptr, input}; }
+
+Token new_token(TokenKind kind) { return Token{kind}; }
 
 bool is_letter(char ch) {
   return ('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z') || ch == '_';
@@ -11,31 +27,63 @@ bool is_letter(char ch) {
 
 bool is_digit(char ch) { return '0' <= ch && ch <= '9'; }
 
-Token lookup_identifier(std::string word) {
-  using namespace token_types;
-  if (word == "fn") {
-    return new_token(Function{});
-  } else if (word == "let") {
-    return new_token(Let{});
-  } else if (word == "if") {
-    return new_token(If{});
-  } else if (word == "else") {
-    return new_token(Else{});
-  } else if (word == "true") {
-    return new_token(True{});
-  } else if (word == "false") {
-    return new_token(False{});
-  } else if (word == "return") {
-    return new_token(Return{});
-  } else {
-    return new_token(Ident{word});
+// {{{ Keywords
+// Perfect hash over the keyword list: the seed is searched at compile time so
+// that every keyword lands in its own slot, and a lookup is one hash plus one
+// compare.
+constexpr size_t KEYWORD_SLOTS{16};
+
+constexpr size_t keyword_slot(std::string_view word, uint32_t seed) {
+  uint32_t h{static_cast<uint32_t>(word.size())};
+  h = h * seed + static_cast<unsigned char>(word.front());
+  h = h * seed + static_cast<unsigned char>(word.back());
+  return (h ^ (h >> 8)) % KEYWORD_SLOTS;
+}
+
+constexpr uint32_t find_keyword_seed() {
+  for (uint32_t seed = 1; seed < (1 << 16); ++seed) {
+    bool used[KEYWORD_SLOTS]{};
+    bool collision{false};
+    for (const auto &k : token_types::keywords) {
+      auto slot{keyword_slot(k.word, seed)};
+      collision |= used[slot];
+      used[slot] = true;
+    }
+    if (!collision) {
+      return seed;
+    }
+  }
+  return 0;
+}
+
+constexpr uint32_t KEYWORD_SEED{find_keyword_seed()};
+static_assert(KEYWORD_SEED != 0, "no perfect hash found, grow KEYWORD_SLOTS");
+
+constexpr std::array<int8_t, KEYWORD_SLOTS> build_keyword_table() {
+  std::array<int8_t, KEYWORD_SLOTS> table{};
+  table.fill(-1);
+  for (size_t i = 0; i < std::size(token_types::keywords); ++i) {
+    table[keyword_slot(token_types::keywords[i].word, KEYWORD_SEED)] = i;
   }
+  return table;
 }
 
+constexpr auto keyword_table{build_keyword_table()};
+
+Token lookup_identifier(std::string_view word) {
+  auto index{keyword_table[keyword_slot(word, KEYWORD_SEED)]};
+  if (index >= 0 && token_types::keywords[index].word == word) {
+    return new_token(token_types::keywords[index].kind);
+  }
+  return Token::ident(intern(word));
+}
+// }}}
+
 Token Lexer::next_token() {
   using namespace token_types;
   Token tok;
   skip_whitespace();
+  start = std::min(position, input.length());
   switch (ch) {
   case '=': {
     if (peek_char() == '=') {
@@ -56,7 +104,7 @@ Token Lexer::next_token() {
     break;
   }
   // clang-format off
-  case '"': tok = new_token(String{read_string()}); break;
+  case '"': tok = Token::string(read_string()); break;
   case ';': tok = new_token(Semicolon{}); break;
   case ':': tok = new_token(Colon{}); break;
   case '(': tok = new_token(LParen{}); break;
@@ -78,7 +126,7 @@ Token Lexer::next_token() {
     if (is_letter(ch)) {
       return lookup_identifier(read_identifier());
     } else if (is_digit(ch)) {
-      return new_token(Int{read_number()});
+      return read_number();
     } else {
       tok = new_token(Illegal{});
     }
@@ -87,25 +135,167 @@ Token Lexer::next_token() {
   return tok;
 }
 
-std::string Lexer::read_string() {
-  auto start{position + 1};
+TokenBuffer Lexer::tokenize_all() {
+  TokenBuffer buffer{};
+  buffer.source = source;
+  if (input.length() > TokenBuffer::MAX_SOURCE_SIZE) {
+    // The offsets can't address it, so the whole source is one illegal token
+    buffer.push_back(new_token(token_types::Illegal{}), 0, 0);
+    buffer.push_back(new_token(token_types::Eof{}), 0, 0);
+    seek(input.length() + 1);
+    return buffer;
+  }
+  // Generated code averages a bit over 3 bytes per token
+  buffer.reserve(input.length() / 3 + 1);
   while (true) {
-    read_char();
-    if (ch == '"' || ch == 0) {
+    auto tok{next_token()};
+    auto stop{std::min(position, input.length())};
+    buffer.push_back(tok, start, stop - start);
+    if (tok.is_type<token_types::Eof>()) {
+      return buffer;
+    }
+  }
+}
+
+// {{{ Parallel lexing
+// Whitespace outside a string literal is a token boundary, and the lexer
+// carries no state across token boundaries, so lexing the pieces separately
+// gives the same tokens as one pass. A position is inside a string iff an odd
+// number of quotes come before it.
+std::vector<size_t> split_points(std::string_view text, size_t begin,
+                                 unsigned parts) {
+  std::vector<size_t> cuts{begin};
+  size_t pos{begin};
+  bool in_string{false};
+  for (unsigned i = 1; i < parts; ++i) {
+    size_t target{begin + (text.length() - begin) * i / parts};
+    if (target <= pos) {
+      continue;
+    }
+    in_string ^= std::count(text.begin() + pos, text.begin() + target, '"') & 1;
+    pos = target;
+    for (; pos < text.length(); ++pos) {
+      if (text[pos] == '"') {
+        in_string = !in_string;
+      } else if (!in_string && (text[pos] == ' ' || text[pos] == '\t' ||
+                                text[pos] == '\n' || text[pos] == '\r')) {
+        break;
+      }
+    }
+    if (pos == text.length()) {
       break;
     }
+    cuts.push_back(pos);
+  }
+  cuts.push_back(text.length());
+  return cuts;
+}
+
+// Appends `part` (minus its EOF unless it is the last one) at the given
+// positions of `out`, rebasing offsets and payload indices
+void merge_part(TokenBuffer &out, const TokenBuffer &part, size_t at,
+                size_t ints_at, size_t strings_at, uint32_t base, bool last) {
+  size_t count{part.size() - (last ? 0 : 1)};
+  for (size_t i = 0; i < count; ++i) {
+    auto kind{part.kinds[i]};
+    auto payload{part.payloads[i]};
+    if (kind == TokenKind::Int) {
+      payload += ints_at;
+    } else if (kind == TokenKind::String) {
+      payload += strings_at;
+    }
+    out.kinds[at + i] = kind;
+    out.offsets[at + i] = part.offsets[i] + base;
+    out.lengths[at + i] = part.lengths[i];
+    out.payloads[at + i] = payload;
+  }
+  std::copy(part.ints.begin(), part.ints.end(), out.ints.begin() + ints_at);
+  std::copy(part.strings.begin(), part.strings.end(),
+            out.strings.begin() + strings_at);
+}
+
+TokenBuffer Lexer::tokenize_parallel(unsigned threads, size_t min_chunk) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  auto begin{std::min(position, input.length())};
+  auto chunks{(input.length() - begin) / std::max<size_t>(min_chunk, 1)};
+  threads = std::min<size_t>(threads, chunks);
+  // A NUL ends the input outside strings but closes a string inside one,
+  // which the quote parity split doesn't model
+  if (threads < 2 || input.length() > TokenBuffer::MAX_SOURCE_SIZE ||
+      input.find('\0', begin) != std::string_view::npos) {
+    return tokenize_all();
+  }
+
+  auto cuts{split_points(input, begin, threads)};
+  auto parts{cuts.size() - 1};
+  std::vector<TokenBuffer> buffers(parts);
+  std::vector<std::thread> workers{};
+  for (size_t i = 0; i < parts; ++i) {
+    workers.emplace_back([&, i]() {
+      buffers[i] = borrow(input.substr(cuts[i], cuts[i + 1] - cuts[i]))
+                       .tokenize_all();
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  workers.clear();
+
+  TokenBuffer result{};
+  result.source = source;
+  std::vector<size_t> at(parts + 1), ints_at(parts + 1), strings_at(parts + 1);
+  for (size_t i = 0; i < parts; ++i) {
+    bool last{i == parts - 1};
+    at[i + 1] = at[i] + buffers[i].size() - (last ? 0 : 1);
+    ints_at[i + 1] = ints_at[i] + buffers[i].ints.size();
+    strings_at[i + 1] = strings_at[i] + buffers[i].strings.size();
   }
+  result.kinds.resize(at[parts]);
+  result.offsets.resize(at[parts]);
+  result.lengths.resize(at[parts]);
+  result.payloads.resize(at[parts]);
+  result.ints.resize(ints_at[parts]);
+  result.strings.resize(strings_at[parts]);
+  for (size_t i = 0; i < parts; ++i) {
+    workers.emplace_back([&, i]() {
+      merge_part(result, buffers[i], at[i], ints_at[i], strings_at[i], cuts[i],
+                 i == parts - 1);
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  seek(input.length() + 1);
+  return result;
+}
+// }}}
+
+std::string_view Lexer::read_string() {
+  auto start{position + 1};
+  seek(scan_from(start, scan::find_string_end));
   return input.substr(start, position - start);
 }
 
-std::string Lexer::read_identifier() {
+std::string_view Lexer::read_identifier() {
   auto start{position};
-  while (is_letter(ch)) {
-    read_char();
-  }
+  seek(scan_from(start, scan::skip_letters));
   return input.substr(start, position - start);
 }
 
+size_t Lexer::scan_from(size_t start, Scanner scanner) const {
+  auto begin{input.data()};
+  auto end{begin + input.length()};
+  return scanner(begin + std::min(start, input.length()), end) - begin;
+}
+
+void Lexer::seek(size_t pos) {
+  position = pos;
+  read_position = pos + 1;
+  ch = pos < input.length() ? input[pos] : 0;
+}
+
 void Lexer::read_char() {
   if (read_position >= input.length()) {
     ch = 0;
@@ -124,15 +314,23 @@ char Lexer::peek_char() {
 }
 
 void Lexer::skip_whitespace() {
-  while (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
-    read_char();
+  if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
+    seek(scan_from(position, scan::skip_whitespace));
   }
 }
 
-IntType Lexer::read_number() {
+Token Lexer::read_number() {
   auto start{position};
   while (is_digit(ch)) {
     read_char();
   }
-  return std::stol(input.substr(start, position - start));
+  IntType value{0};
+  auto result{std::from_chars(input.data() + start, input.data() + position,
+                              value)};
+  if (result.ec != std::errc{}) {
+    return new_token(token_types::Illegal{});
+  }
+  return Token::number(value);
 }
+
+// vim:foldmethod=marker
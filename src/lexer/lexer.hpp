@@ -1,19 +1,52 @@
 #pragma once
 #include "../token/token.hpp"
+#include "source.hpp"
+#include "token_buffer.hpp"
+#include <memory>
+#include <string_view>
 
-class Lexer {
+class TokenSource {
+public:
+  virtual ~TokenSource() = default;
+  virtual Token next_token() = 0;
+};
+
+class Lexer : public TokenSource {
 public:
   Lexer(std::string input);
-  Token next_token();
+  Lexer(std::shared_ptr<const Source> source);
+  // Lexes `input` in place without copying it. The caller keeps the buffer
+  // alive for as long as the lexer and its tokens are in use.
+  static Lexer borrow(std::string_view input);
+  virtual Token next_token() override;
+  // Lexes everything left in one pass. Token offsets are relative to the
+  // start of the input.
+  TokenBuffer tokenize_all();
+  // Same result as tokenize_all(), but the input is cut into up to `threads`
+  // chunks at whitespace outside string literals and the chunks are lexed in
+  // parallel. Inputs smaller than `min_chunk` per thread are lexed serially.
+  // `threads` = 0 uses every hardware thread.
+  TokenBuffer tokenize_parallel(unsigned threads = 0,
+                                size_t min_chunk = 256 * 1024);
+  // Index of the first character the lexer has not consumed yet
+  size_t offset() const { return position; }
+  // Index where the last token returned by next_token() starts
+  size_t token_start() const { return start; }
 
 private:
+  Lexer(std::shared_ptr<const Source> source, std::string_view input);
+  using Scanner = const char *(*)(const char *, const char *);
   void read_char();
   char peek_char();
-  IntType read_number();
+  void seek(size_t);
+  size_t scan_from(size_t, Scanner) const;
+  Token read_number();
   void skip_whitespace();
-  std::string read_identifier();
-  std::string read_string();
-  std::string input;
+  std::string_view read_identifier();
+  std::string_view read_string();
+  std::shared_ptr<const Source> source;
+  std::string_view input;
+  size_t start{0};
   size_t position{0};
   size_t read_position{0};
   char ch{0};
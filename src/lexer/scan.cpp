@@ -0,0 +1,199 @@
+#include "scan.hpp"
+
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+namespace {
+bool is_space(char ch) {
+  return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
+bool is_letter(char ch) {
+  return ('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z') || ch == '_';
+}
+
+// {{{ Scalar
+const char *skip_whitespace_scalar(const char *p, const char *end) {
+  while (p < end && is_space(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+const char *skip_letters_scalar(const char *p, const char *end) {
+  while (p < end && is_letter(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+const char *find_string_end_scalar(const char *p, const char *end) {
+  while (p < end && *p != '"' && *p != 0) {
+    ++p;
+  }
+  return p;
+}
+// }}}
+
+#ifdef SCAN_X86
+// {{{ SSE2
+__m128i whitespace_sse2(__m128i v) {
+  return _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+}
+
+// (ch | 0x20) - 'a' <= 25 (unsigned) folds both letter cases into one test
+__m128i letters_sse2(__m128i v) {
+  auto offset{_mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+                           _mm_set1_epi8('a'))};
+  auto alpha{
+      _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(25)), offset)};
+  return _mm_or_si128(alpha, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+}
+
+__m128i string_end_sse2(__m128i v) {
+  return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                      _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+}
+
+const char *skip_whitespace_sse2(const char *p, const char *end) {
+  for (; end - p >= 16; p += 16) {
+    auto v{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))};
+    unsigned stop{~_mm_movemask_epi8(whitespace_sse2(v)) & 0xFFFFu};
+    if (stop) {
+      return p + __builtin_ctz(stop);
+    }
+  }
+  return skip_whitespace_scalar(p, end);
+}
+
+const char *skip_letters_sse2(const char *p, const char *end) {
+  for (; end - p >= 16; p += 16) {
+    auto v{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))};
+    unsigned stop{~_mm_movemask_epi8(letters_sse2(v)) & 0xFFFFu};
+    if (stop) {
+      return p + __builtin_ctz(stop);
+    }
+  }
+  return skip_letters_scalar(p, end);
+}
+
+const char *find_string_end_sse2(const char *p, const char *end) {
+  for (; end - p >= 16; p += 16) {
+    auto v{_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))};
+    unsigned stop{static_cast<unsigned>(_mm_movemask_epi8(string_end_sse2(v)))};
+    if (stop) {
+      return p + __builtin_ctz(stop);
+    }
+  }
+  return find_string_end_scalar(p, end);
+}
+// }}}
+
+// {{{ AVX2
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 __m256i whitespace_avx2(__m256i v) {
+  return _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+}
+
+AVX2 __m256i letters_avx2(__m256i v) {
+  auto offset{_mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)),
+                              _mm256_set1_epi8('a'))};
+  auto alpha{_mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(25)),
+                               offset)};
+  return _mm256_or_si256(alpha, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+}
+
+AVX2 __m256i string_end_avx2(__m256i v) {
+  return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                         _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+}
+
+AVX2 const char *skip_whitespace_avx2(const char *p, const char *end) {
+  for (; end - p >= 32; p += 32) {
+    auto v{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))};
+    unsigned stop{~static_cast<unsigned>(
+        _mm256_movemask_epi8(whitespace_avx2(v)))};
+    if (stop) {
+      return p + __builtin_ctz(stop);
+    }
+  }
+  return skip_whitespace_sse2(p, end);
+}
+
+AVX2 const char *skip_letters_avx2(const char *p, const char *end) {
+  for (; end - p >= 32; p += 32) {
+    auto v{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))};
+    unsigned stop{
+        ~static_cast<unsigned>(_mm256_movemask_epi8(letters_avx2(v)))};
+    if (stop) {
+      return p + __builtin_ctz(stop);
+    }
+  }
+  return skip_letters_sse2(p, end);
+}
+
+AVX2 const char *find_string_end_avx2(const char *p, const char *end) {
+  for (; end - p >= 32; p += 32) {
+    auto v{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))};
+    unsigned stop{
+        static_cast<unsigned>(_mm256_movemask_epi8(string_end_avx2(v)))};
+    if (stop) {
+      return p + __builtin_ctz(stop);
+    }
+  }
+  return find_string_end_sse2(p, end);
+}
+
+#undef AVX2
+// }}}
+#endif
+
+using Scanner = const char *(*)(const char *, const char *);
+
+struct Kernels {
+  Scanner skip_whitespace;
+  Scanner skip_letters;
+  Scanner find_string_end;
+};
+
+Kernels select_kernels() {
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {skip_whitespace_avx2, skip_letters_avx2, find_string_end_avx2};
+  }
+  return {skip_whitespace_sse2, skip_letters_sse2, find_string_end_sse2};
+#else
+  return {skip_whitespace_scalar, skip_letters_scalar, find_string_end_scalar};
+#endif
+}
+
+const Kernels kernels{select_kernels()};
+} // namespace
+
+namespace scan {
+const char *skip_whitespace(const char *p, const char *end) {
+  return kernels.skip_whitespace(p, end);
+}
+
+const char *skip_letters(const char *p, const char *end) {
+  return kernels.skip_letters(p, end);
+}
+
+const char *find_string_end(const char *p, const char *end) {
+  return kernels.find_string_end(p, end);
+}
+} // namespace scan
+
+// vim:foldmethod=marker
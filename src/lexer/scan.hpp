@@ -0,0 +1,11 @@
+#pragma once
+
+// Vectorized scanners for the lexer's longest runs. Each returns the first
+// position in [p, end) that does not continue the run, or `end`. They use
+// AVX2 when the CPU has it, SSE2 otherwise, and plain loops off x86.
+namespace scan {
+const char *skip_whitespace(const char *p, const char *end);
+const char *skip_letters(const char *p, const char *end);
+// Stops at the closing quote or a NUL, which the lexer treats as end of input
+const char *find_string_end(const char *p, const char *end);
+} // namespace scan
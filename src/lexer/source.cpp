@@ -0,0 +1,50 @@
+#include "source.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::shared_ptr<const Source> Source::from_string(std::string input) {
+  auto source{std::shared_ptr<Source>(new Source{})};
+  source->owned = std::move(input);
+  return source;
+}
+
+std::shared_ptr<const Source> Source::map_file(const std::string &path) {
+  int fd{open(path.c_str(), O_RDONLY)};
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return nullptr;
+  }
+  auto source{std::shared_ptr<Source>(new Source{})};
+  // mmap refuses zero-length mappings, an empty file is just an empty source
+  if (st.st_size > 0) {
+    void *addr{mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)};
+    if (addr == MAP_FAILED) {
+      close(fd);
+      return nullptr;
+    }
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    source->mapped = addr;
+    source->mapped_length = st.st_size;
+  }
+  close(fd);
+  return source;
+}
+
+Source::~Source() {
+  if (mapped) {
+    munmap(mapped, mapped_length);
+  }
+}
+
+std::string_view Source::view() const {
+  if (mapped) {
+    return std::string_view{static_cast<const char *>(mapped), mapped_length};
+  }
+  return owned;
+}
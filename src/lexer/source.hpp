@@ -0,0 +1,23 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Backing storage for lexer input. Tokens point straight into the source
+// buffer, so a Source has to outlive every token lexed from it.
+class Source {
+public:
+  static std::shared_ptr<const Source> from_string(std::string);
+  // Maps the file read-only. Returns nullptr if it cannot be opened.
+  static std::shared_ptr<const Source> map_file(const std::string &path);
+  Source(const Source &) = delete;
+  Source &operator=(const Source &) = delete;
+  ~Source();
+  std::string_view view() const;
+
+private:
+  Source() = default;
+  std::string owned{};
+  void *mapped{nullptr};
+  size_t mapped_length{0};
+};
@@ -0,0 +1,95 @@
+#include "stream_lexer.hpp"
+#include "scan.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+StreamLexer::StreamLexer(std::istream &in, size_t chunk_size)
+    : StreamLexer(
+          [&in](char *out, size_t n) -> size_t {
+            in.read(out, n);
+            return in.gcount();
+          },
+          chunk_size) {}
+
+StreamLexer::StreamLexer(int fd, size_t chunk_size)
+    : StreamLexer(
+          [fd](char *out, size_t n) -> size_t {
+            ssize_t got;
+            do {
+              got = ::read(fd, out, n);
+            } while (got < 0 && errno == EINTR);
+            return got > 0 ? got : 0;
+          },
+          chunk_size) {}
+
+StreamLexer::StreamLexer(Reader reader, size_t chunk_size)
+    : read(std::move(reader)), chunk_size(std::max<size_t>(chunk_size, 1)),
+      buffer(this->chunk_size) {}
+
+Token StreamLexer::next_token() {
+  while (!eof && !token_complete()) {
+    refill();
+  }
+  auto lexer{Lexer::borrow({buffer.data() + begin, end - begin})};
+  auto tok{lexer.next_token()};
+  begin += std::min(lexer.offset(), end - begin);
+  scanned = 0;
+  return stabilize(tok);
+}
+
+bool StreamLexer::token_complete() {
+  const char *last{buffer.data() + end};
+  auto *first{scan::skip_whitespace(buffer.data() + begin, last)};
+  begin = first - buffer.data();
+  if (first == last) {
+    return false;
+  }
+  // Runs and strings only end at a character that is in the buffer already.
+  // Scanning picks up where the last refill interrupted it.
+  auto *from{first + std::max<size_t>(scanned, 1)};
+  const char *stop{nullptr};
+  if (*first == '"') {
+    stop = scan::find_string_end(from, last);
+  } else if (*first >= '0' && *first <= '9') {
+    auto not_digit{[](char c) { return c < '0' || c > '9'; }};
+    stop = std::find_if(from, last, not_digit);
+  } else if (auto *letters{scan::skip_letters(first, first + 1)};
+             letters > first) {
+    stop = scan::skip_letters(from, last);
+  } else {
+    // `==` and `!=` need a look at the next character
+    return (*first != '=' && *first != '!') || last - first > 1;
+  }
+  scanned = stop - first;
+  return stop < last;
+}
+
+bool StreamLexer::refill() {
+  // Everything before `begin` has been handed out already
+  std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+  end -= begin;
+  begin = 0;
+  // Doubling keeps a long token at a linear number of bytes read and moved
+  if (end == buffer.size()) {
+    buffer.resize(buffer.size() * 2);
+  }
+  auto got{read(buffer.data() + end, buffer.size() - end)};
+  if (got == 0) {
+    eof = true;
+    return false;
+  }
+  end += got;
+  return true;
+}
+
+Token StreamLexer::stabilize(Token tok) {
+  if (!tok.is_type<token_types::String>()) {
+    return tok;
+  }
+  auto &slot{slots[next_slot]};
+  slot.assign(tok.string_value());
+  next_slot ^= 1;
+  return Token::string(slot);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "lexer.hpp"
+#include <functional>
+#include <istream>
+#include <string>
+#include <vector>
+
+// Lexes input pulled through a refill buffer, so memory stays bounded by the
+// chunk size and twice the longest token instead of the whole program. A
+// token is only lexed once the buffer holds all of it, so identifiers cut by
+// a refill never get interned half-read.
+//
+// String payloads are copied into two rotating slots, so a token's payload
+// stays valid until two more tokens have been lexed. That covers the parser's
+// current + peek token window.
+class StreamLexer : public TokenSource {
+public:
+  static constexpr size_t DEFAULT_CHUNK_SIZE{64 * 1024};
+  StreamLexer(std::istream &in, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+  StreamLexer(int fd, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+  virtual Token next_token() override;
+
+private:
+  using Reader = std::function<size_t(char *, size_t)>;
+  StreamLexer(Reader, size_t chunk_size);
+  bool refill();
+  // Whether the buffer holds the whole next token. Skips the whitespace
+  // before it.
+  bool token_complete();
+  Token stabilize(Token);
+  Reader read;
+  size_t chunk_size;
+  std::vector<char> buffer;
+  size_t begin{0};
+  size_t end{0};
+  // How much of the pending token, from `begin`, is known to be in the buffer
+  size_t scanned{0};
+  bool eof{false};
+  std::string slots[2]{};
+  size_t next_slot{0};
+};
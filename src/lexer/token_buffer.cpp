@@ -0,0 +1,48 @@
+#include "token_buffer.hpp"
+
+void TokenBuffer::reserve(size_t n) {
+  kinds.reserve(n);
+  offsets.reserve(n);
+  lengths.reserve(n);
+  payloads.reserve(n);
+}
+
+void TokenBuffer::push_back(const Token &tok, uint32_t offset,
+                            uint32_t length) {
+  uint32_t payload{0};
+  switch (tok.kind) {
+  case TokenKind::Ident:
+    payload = tok.symbol();
+    break;
+  case TokenKind::Int:
+    payload = ints.size();
+    ints.push_back(tok.int_value());
+    break;
+  case TokenKind::String:
+    payload = strings.size();
+    strings.push_back(tok.string_value());
+    break;
+  default:
+    break;
+  }
+  kinds.push_back(tok.kind);
+  offsets.push_back(offset);
+  lengths.push_back(length);
+  payloads.push_back(payload);
+}
+
+Token TokenBuffer::token(size_t i) const {
+  if (i >= kinds.size()) {
+    return Token{TokenKind::Eof};
+  }
+  switch (kinds[i]) {
+  case TokenKind::Ident:
+    return Token::ident(payloads[i]);
+  case TokenKind::Int:
+    return Token::number(ints[payloads[i]]);
+  case TokenKind::String:
+    return Token::string(strings[payloads[i]]);
+  default:
+    return Token{kinds[i]};
+  }
+}
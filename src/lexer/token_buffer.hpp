@@ -0,0 +1,29 @@
+#pragma once
+#include "../token/token.hpp"
+#include "source.hpp"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Structure-of-arrays token stream filled by Lexer::tokenize_all(). `kinds`
+// holds TokenKinds. `payloads` holds the Symbol of an Ident, or the index
+// into `ints` / `strings` for Int and String tokens. Offsets are byte offsets
+// into the source, so sources are limited to 4GiB.
+
+struct TokenBuffer {
+  static constexpr size_t MAX_SOURCE_SIZE{UINT32_MAX};
+  std::vector<TokenKind> kinds{};
+  std::vector<uint32_t> offsets{};
+  std::vector<uint32_t> lengths{};
+  std::vector<uint32_t> payloads{};
+  std::vector<IntType> ints{};
+  std::vector<std::string_view> strings{};
+  // Keeps the string payloads alive, null when the lexer borrowed its input
+  std::shared_ptr<const Source> source{};
+
+  size_t size() const { return kinds.size(); }
+  void reserve(size_t);
+  void push_back(const Token &, uint32_t offset, uint32_t length);
+  // Rebuilds the token at `i`. Anything past the end is EOF.
+  Token token(size_t i) const;
+};
@@ -1,34 +1,77 @@
 #include "environment.hpp"
 #include <sstream>
 
-Environment::Environment() : outer(nullptr) {}
-Environment::Environment(std::shared_ptr<Environment> env) : outer(env) {}
+static uint64_t next_id{1};
 
-#include <iostream>
-std::shared_ptr<Object> Environment::get(const std::string &name) {
-  if (store.contains(name)) {
-    return store[name];
-  } else if (outer) {
-    return outer->get(name);
-  } else {
-    return nullptr;
+Environment::Environment() : outer(nullptr), unique_id(next_id++) {}
+Environment::Environment(std::shared_ptr<Environment> globals,
+                         std::shared_ptr<Function> function)
+    : slots(function->literal->locals.size()), function(std::move(function)),
+      outer(std::move(globals)), unique_id(next_id++) {
+  auto *literal{this->function->literal};
+  if (!literal->cells.empty()) {
+    cells.resize(literal->locals.size());
+    for (auto i : literal->cells) {
+      cells[i] = std::make_shared<Cell>();
+    }
+    for (auto [local, capture] : literal->shadows) {
+      cells[local]->shadowed = this->function->captures[capture];
+    }
+  }
+  if (auto self{literal->self}; self != FunctionLiteral::NO_SELF) {
+    (cells.empty() || !cells[self] ? slots[self] : cells[self]->value) =
+        this->function;
+  }
+}
+
+std::shared_ptr<Object> Environment::get(Symbol name) {
+  for (auto *env{this}; env; env = env->outer.get()) {
+    auto it{env->store.find(name)};
+    if (it != env->store.end()) {
+      return it->second;
+    }
   }
+  return nullptr;
 }
-std::shared_ptr<Object> Environment::set(const std::string &name,
+std::shared_ptr<Object> Environment::set(Symbol name,
                                          std::shared_ptr<Object> object) {
-  store[name] = std::move(object);
-  return store[name];
+  auto &slot{store[name]};
+  slot = std::move(object);
+  return slot;
+}
+
+std::vector<std::shared_ptr<Cell>>
+Environment::capture_for(std::span<const Capture> captures) {
+  std::vector<std::shared_ptr<Cell>> out{};
+  out.reserve(captures.size());
+  for (auto capture : captures) {
+    out.push_back(capture.cell ? cells[capture.index]
+                               : function->captures[capture.index]);
+  }
+  return out;
 }
 
 std::string Environment::inspect() {
   std::stringstream ss;
-  for (const auto &k : store) {
-    ss << k.first << " = " << k.second->inspect() << std::endl;
-  }
-  if (outer) {
-    for (const auto &k : outer->store) {
-      ss << k.first << " = " << k.second->inspect() << std::endl;
+  auto print{[&ss](const Environment &env) {
+    if (env.function) {
+      auto locals{env.function->literal->locals};
+      for (size_t i = 0; i < locals.size(); i++) {
+        auto &value{env.cells.empty() || !env.cells[i] ? env.slots[i]
+                                                       : env.cells[i]->value};
+        if (value) {
+          ss << symbol_name(locals[i]) << " = " << value->inspect()
+             << std::endl;
+        }
+      }
+    }
+    for (const auto &k : env.store) {
+      ss << symbol_name(k.first) << " = " << k.second->inspect() << std::endl;
     }
+  }};
+  print(*this);
+  if (outer) {
+    print(*outer);
   }
   return ss.str();
 }
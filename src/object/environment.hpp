@@ -2,16 +2,53 @@
 #include "object.hpp"
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 class Environment {
 public:
   Environment();
-  Environment(std::shared_ptr<Environment> env);
+  // A call of `function`, whose literal has been resolved. Globals are
+  // looked up in `globals`.
+  Environment(std::shared_ptr<Environment> globals,
+              std::shared_ptr<Function> function);
   std::string inspect();
-  std::shared_ptr<Object> get(const std::string &);
-  std::shared_ptr<Object> set(const std::string &, std::shared_ptr<Object>);
+  // By name, from this scope outwards
+  std::shared_ptr<Object> get(Symbol);
+  std::shared_ptr<Object> set(Symbol, std::shared_ptr<Object>);
+  // Where this scope keeps `name` if it has it by name. Entries are never
+  // removed, so the pointer stays valid as long as the environment.
+  std::shared_ptr<Object> *find(Symbol name) {
+    auto it{store.find(name)};
+    return it == store.end() ? nullptr : &it->second;
+  }
+  // Unique for the whole run, unlike addresses
+  uint64_t id() const { return unique_id; }
+  // For resolved identifiers. Reads of cells and captures see through
+  // unassigned locals to the variables they shadow.
+  std::shared_ptr<Object> &slot(size_t i) { return slots[i]; }
+  std::shared_ptr<Object> &cell(size_t i) { return cells[i]->value; }
+  const std::shared_ptr<Object> &read_cell(size_t i) const {
+    return cells[i]->get();
+  }
+  const std::shared_ptr<Object> &capture(size_t i) const {
+    return function->captures[i]->get();
+  }
+  // What a closure created in this call captures
+  std::vector<std::shared_ptr<Cell>> capture_for(std::span<const Capture>);
+  // The outermost scope, with the globals
+  const std::shared_ptr<Environment> &
+  globals(const std::shared_ptr<Environment> &self) const {
+    return outer ? outer->globals(outer) : self;
+  }
 
 private:
-  std::unordered_map<std::string, std::shared_ptr<Object>> store{};
+  std::vector<std::shared_ptr<Object>> slots{};
+  std::vector<std::shared_ptr<Cell>> cells{};
+  // Keeps the captures alive for the call
+  std::shared_ptr<Function> function{};
+  // Globals, and names that have no slot. Symbols hash to themselves, lookups
+  // never touch the name.
+  std::unordered_map<Symbol, std::shared_ptr<Object>> store{};
   std::shared_ptr<Environment> outer;
+  uint64_t unique_id;
 };
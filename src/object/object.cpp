@@ -1,4 +1,5 @@
 #include "object.hpp"
+#include <iterator>
 #include <sstream>
 
 bool HashKey::operator==(const HashKey &other) const {
@@ -35,8 +36,33 @@ std::string String::inspect() const { return value; }
 ObjectType String::type() const { return ObjectType::STRING_OBJ; }
 HashKey String::hash_key() const { return HashKey{type(), fnv64(value)}; }
 
+// Drops `pending`, emptying the arrays and hashes that only it holds on the
+// way so that each is destroyed without anything left to recurse into
+void release(std::vector<std::shared_ptr<Object>> pending) {
+  while (!pending.empty()) {
+    auto last{std::move(pending.back())};
+    pending.pop_back();
+    if (!last || last.use_count() != 1) {
+      continue;
+    }
+    if (last->type() == ObjectType::ARRAY_OBJ) {
+      auto &elements{static_cast<Array &>(*last).elements};
+      std::move(elements.begin(), elements.end(), std::back_inserter(pending));
+      elements.clear();
+    } else if (last->type() == ObjectType::HASH_OBJ) {
+      auto &pairs{static_cast<Hash &>(*last).pairs};
+      for (auto &[_, pair] : pairs) {
+        pending.push_back(std::move(pair.key));
+        pending.push_back(std::move(pair.value));
+      }
+      pairs.clear();
+    }
+  }
+}
+
 Array::Array(std::vector<std::shared_ptr<Object>> elements)
     : elements(elements) {}
+Array::~Array() { release(std::move(elements)); }
 std::string Array::inspect() const {
   std::stringstream ss;
   ss << "[";
@@ -85,14 +111,17 @@ std::string to_string(ObjectType t) {
     return "ARRAY";
   case ObjectType::HASH_OBJ:
     return "HASH";
+  case ObjectType::TAIL_CALL_OBJ:
+    return "TAIL_CALL";
   }
 }
 } // namespace std
 
-Function::Function(std::vector<Identifier> params,
-                   std::shared_ptr<BlockStatement> body,
-                   std::shared_ptr<Environment> env)
-    : params(std::move(params)), body(std::move(body)), env(env) {}
+Function::Function(const FunctionLiteral *literal,
+                   std::vector<std::shared_ptr<Cell>> captures)
+    : params(literal->params), literal(literal),
+      captures(std::move(captures)),
+      arena(literal->arena->shared_from_this()) {}
 std::string Function::inspect() const {
   std::stringstream ss;
   ss << "fn(";
@@ -102,16 +131,38 @@ std::string Function::inspect() const {
       ss << ", ";
     }
   }
-  ss << ") {\n" << body->to_string() << "\n}";
+  ss << ") {\n";
+  if (auto *body{literal->body()}) {
+    ss << body->to_string();
+  } else {
+    ss << "<" << literal->body_error() << ">";
+  }
+  ss << "\n}";
   return ss.str();
 }
 ObjectType Function::type() const { return ObjectType::FUNCTION_OBJ; }
 
+TailCall::TailCall(std::shared_ptr<Function> function,
+                   std::vector<std::shared_ptr<Object>> args)
+    : function(std::move(function)), args(std::move(args)) {}
+std::string TailCall::inspect() const { return "tail call"; }
+ObjectType TailCall::type() const { return ObjectType::TAIL_CALL_OBJ; }
+
 Builtin::Builtin(BuiltinFunction fn) : fn(fn) {}
 std::string Builtin::inspect() const { return "builtin function"; }
 ObjectType Builtin::type() const { return ObjectType::BUILTIN_OBJ; }
 
 Hash::Hash(std::unordered_map<HashKey, HashPair> pairs) : pairs(pairs) {}
+Hash::~Hash() {
+  if (!pairs.empty()) {
+    std::vector<std::shared_ptr<Object>> pending{};
+    for (auto &[_, pair] : pairs) {
+      pending.push_back(std::move(pair.key));
+      pending.push_back(std::move(pair.value));
+    }
+    release(std::move(pending));
+  }
+}
 std::string Hash::inspect() const {
   std::stringstream ss;
   auto size{pairs.size()};
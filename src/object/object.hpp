@@ -16,7 +16,10 @@ enum class ObjectType : uint8_t {
   BUILTIN_OBJ,
   ARRAY_OBJ,
   HASH_OBJ,
+  TAIL_CALL_OBJ,
 };
+inline constexpr size_t OBJECT_TYPE_COUNT{
+    static_cast<size_t>(ObjectType::TAIL_CALL_OBJ) + 1};
 
 namespace std {
 std::string to_string(ObjectType);
@@ -76,9 +79,12 @@ public:
   std::string value;
 };
 
+// Arrays and hashes empty the nested ones they own before those are
+// destroyed, so dropping a deeply nested value doesn't recurse
 class Array : public Object {
 public:
   Array(std::vector<std::shared_ptr<Object>>);
+  ~Array();
   virtual std::string inspect() const override;
   virtual ObjectType type() const override;
   std::vector<std::shared_ptr<Object>> elements;
@@ -106,17 +112,45 @@ public:
   std::string value;
 };
 
-class Environment;
+// A local that closures capture. The call and every closure made in it share
+// the cell, so they all see later assignments.
+struct Cell {
+  std::shared_ptr<Object> value{};
+  // For a local shadowing an outer variable, the outer variable's cell
+  std::shared_ptr<Cell> shadowed{};
+  // The value, or while unassigned that of the variable it shadows
+  const std::shared_ptr<Object> &get() const {
+    auto *cell{this};
+    while (!cell->value && cell->shadowed) {
+      cell = cell->shadowed.get();
+    }
+    return cell->value;
+  }
+};
 
 class Function : public Object {
 public:
-  Function(std::vector<Identifier>, std::shared_ptr<BlockStatement>,
-           std::shared_ptr<Environment>);
+  Function(const FunctionLiteral *, std::vector<std::shared_ptr<Cell>>);
+  virtual std::string inspect() const override;
+  virtual ObjectType type() const override;
+  std::span<Identifier> params;
+  const FunctionLiteral *literal;
+  // Only the variables the body uses, laid out as `literal->captures`.
+  // Globals are reached through the caller instead.
+  std::vector<std::shared_ptr<Cell>> captures;
+  // Keeps `params` and `literal` alive
+  std::shared_ptr<const AstArena> arena;
+};
+
+// A call in tail position, handed back to apply_function to run in place of
+// the current one. Never escapes a function call.
+class TailCall : public Object {
+public:
+  TailCall(std::shared_ptr<Function>, std::vector<std::shared_ptr<Object>>);
   virtual std::string inspect() const override;
   virtual ObjectType type() const override;
-  std::vector<Identifier> params;
-  std::shared_ptr<BlockStatement> body;
-  std::shared_ptr<Environment> env;
+  std::shared_ptr<Function> function;
+  std::vector<std::shared_ptr<Object>> args;
 };
 
 using BuiltinFunction = std::function<std::shared_ptr<Object>(
@@ -138,6 +172,7 @@ struct HashPair {
 class Hash : public Object {
 public:
   Hash(std::unordered_map<HashKey, HashPair>);
+  ~Hash();
   virtual std::string inspect() const override;
   virtual ObjectType type() const override;
   std::unordered_map<HashKey, HashPair> pairs;
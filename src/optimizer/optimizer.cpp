@@ -0,0 +1,331 @@
+#include "optimizer.hpp"
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace {
+// A node waiting to be folded. Expressions are visited twice: once to push
+// their operands, then again to fold them once the operands are done.
+struct Task {
+  Node *node;
+  // Where the folded expression goes, null for statements
+  Expression **slot;
+  // Where new nodes go: the arena of the function the node belongs to
+  AstArena *arena;
+  uint8_t step;
+};
+
+// Works through an explicit stack, like the parser and the evaluator, so
+// nesting depth isn't limited by the C++ stack
+class Folder {
+public:
+  void run(Statement *, AstArena &);
+
+private:
+  void push(Statement *s, AstArena &arena) {
+    if (s) {
+      tasks.push_back({s, nullptr, &arena, 0});
+    }
+  }
+  void push(Expression *&e, AstArena &arena) {
+    if (e) {
+      tasks.push_back({e, &e, &arena, 0});
+    }
+  }
+  void statement(Statement *, AstArena &);
+  void expression(Task);
+  Expression *prefix(PrefixExpression *, AstArena &);
+  Expression *infix(InfixExpression *, AstArena &);
+  void if_expression(Task);
+  std::vector<Task> tasks{};
+};
+
+Expression *integer(AstArena &arena, IntType value) {
+  return arena.make<IntegerLiteral>(value);
+}
+Expression *boolean(AstArena &arena, bool value) {
+  return arena.make<BooleanLiteral>(value);
+}
+
+// is_truthy() for literals. False if `e` isn't one.
+bool literal_truth(const Expression *e, bool &truthy) {
+  switch (e ? generic_kind(e->kind) : NodeKind::Program) {
+  case NodeKind::IntegerLiteral:
+    truthy = static_cast<const IntegerLiteral *>(e)->value != 0;
+    return true;
+  case NodeKind::BooleanLiteral:
+    truthy = static_cast<const BooleanLiteral *>(e)->value;
+    return true;
+  case NodeKind::StringLiteral:
+    truthy = true;
+    return true;
+  default:
+    return false;
+  }
+}
+
+void Folder::run(Statement *root, AstArena &arena) {
+  push(root, arena);
+  while (!tasks.empty()) {
+    auto task{tasks.back()};
+    tasks.pop_back();
+    if (task.slot) {
+      expression(task);
+    } else {
+      statement(static_cast<Statement *>(task.node), *task.arena);
+    }
+  }
+}
+
+void Folder::statement(Statement *s, AstArena &arena) {
+  switch (s->kind) {
+  case NodeKind::LetStatement:
+    push(static_cast<LetStatement *>(s)->value, arena);
+    break;
+  case NodeKind::ReturnStatement:
+    push(static_cast<ReturnStatement *>(s)->value, arena);
+    break;
+  case NodeKind::ExpressionStatement:
+    push(static_cast<ExpressionStatement *>(s)->value, arena);
+    break;
+  case NodeKind::BlockStatement:
+    for (auto *statement : static_cast<BlockStatement *>(s)->statements) {
+      push(statement, arena);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void Folder::expression(Task task) {
+  auto *e{static_cast<Expression *>(task.node)};
+  auto &arena{*task.arena};
+  switch (generic_kind(e->kind)) {
+  case NodeKind::PrefixExpression:
+    if (task.step == 0) {
+      tasks.push_back({e, task.slot, &arena, 1});
+      push(static_cast<PrefixExpression *>(e)->right, arena);
+    } else {
+      *task.slot = prefix(static_cast<PrefixExpression *>(e), arena);
+    }
+    break;
+  case NodeKind::InfixExpression:
+    if (task.step == 0) {
+      auto *infix_node{static_cast<InfixExpression *>(e)};
+      tasks.push_back({e, task.slot, &arena, 1});
+      push(infix_node->left, arena);
+      push(infix_node->right, arena);
+    } else {
+      *task.slot = infix(static_cast<InfixExpression *>(e), arena);
+    }
+    break;
+  case NodeKind::IfExpression:
+    if_expression(task);
+    break;
+  case NodeKind::ArrayLiteral:
+    for (auto &element : static_cast<ArrayLiteral *>(e)->elements) {
+      push(element, arena);
+    }
+    break;
+  case NodeKind::HashLiteral:
+    for (auto &[key, value] : static_cast<HashLiteral *>(e)->pairs) {
+      push(key, arena);
+      push(value, arena);
+    }
+    break;
+  case NodeKind::IndexExpression: {
+    auto *index{static_cast<IndexExpression *>(e)};
+    push(index->left, arena);
+    push(index->index, arena);
+    break;
+  }
+  case NodeKind::CallExpression: {
+    auto *call{static_cast<CallExpression *>(e)};
+    push(call->function, arena);
+    for (auto &argument : call->arguments) {
+      push(argument, arena);
+    }
+    break;
+  }
+  case NodeKind::FunctionLiteral: {
+    auto *function{static_cast<FunctionLiteral *>(e)};
+    if (function->body_parsed()) {
+      push(function->body(), *function->arena);
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+Expression *Folder::prefix(PrefixExpression *e, AstArena &arena) {
+  bool truthy{};
+  if (e->opcode == Opcode::Not && literal_truth(e->right, truthy)) {
+    return boolean(arena, !truthy);
+  }
+  if (e->opcode == Opcode::Neg && e->right->kind == NodeKind::IntegerLiteral) {
+    auto value{static_cast<IntegerLiteral *>(e->right)->value};
+    if (value != std::numeric_limits<IntType>::min()) {
+      return integer(arena, -value);
+    }
+  }
+  return e;
+}
+
+Expression *Folder::infix(InfixExpression *e, AstArena &arena) {
+  if (!e->left || !e->right || e->left->kind != e->right->kind) {
+    return e;
+  }
+
+  switch (e->left->kind) {
+  case NodeKind::IntegerLiteral: {
+    auto lhs{static_cast<IntegerLiteral *>(e->left)->value};
+    auto rhs{static_cast<IntegerLiteral *>(e->right)->value};
+    IntType out{};
+    switch (e->opcode) {
+    case Opcode::Add:
+      return __builtin_add_overflow(lhs, rhs, &out) ? e : integer(arena, out);
+    case Opcode::Sub:
+      return __builtin_sub_overflow(lhs, rhs, &out) ? e : integer(arena, out);
+    case Opcode::Mul:
+      return __builtin_mul_overflow(lhs, rhs, &out) ? e : integer(arena, out);
+    case Opcode::Div:
+      if (rhs == 0 ||
+          (lhs == std::numeric_limits<IntType>::min() && rhs == -1)) {
+        return e;
+      }
+      return integer(arena, lhs / rhs);
+    case Opcode::Lt:
+      return boolean(arena, lhs < rhs);
+    case Opcode::Gt:
+      return boolean(arena, lhs > rhs);
+    case Opcode::Eq:
+      return boolean(arena, lhs == rhs);
+    case Opcode::NotEq:
+      return boolean(arena, lhs != rhs);
+    default:
+      return e;
+    }
+  }
+  case NodeKind::BooleanLiteral: {
+    auto lhs{static_cast<BooleanLiteral *>(e->left)->value};
+    auto rhs{static_cast<BooleanLiteral *>(e->right)->value};
+    if (e->opcode == Opcode::Eq) {
+      return boolean(arena, lhs == rhs);
+    } else if (e->opcode == Opcode::NotEq) {
+      return boolean(arena, lhs != rhs);
+    }
+    return e;
+  }
+  case NodeKind::StringLiteral:
+    if (e->opcode == Opcode::Add) {
+      auto text{std::string{static_cast<StringLiteral *>(e->left)->value} +
+                std::string{static_cast<StringLiteral *>(e->right)->value}};
+      return arena.make<StringLiteral>(arena.copy(text));
+    }
+    return e;
+  default:
+    return e;
+  }
+}
+
+// Step 0 folds the condition, step 1 picks the branches to fold and step 2
+// replaces the if with its constant branch
+void Folder::if_expression(Task task) {
+  auto *e{static_cast<IfExpression *>(task.node)};
+  auto &arena{*task.arena};
+  bool truthy{};
+  switch (task.step) {
+  case 0:
+    tasks.push_back({e, task.slot, &arena, 1});
+    push(e->condition, arena);
+    return;
+  case 1:
+    if (!literal_truth(e->condition, truthy)) {
+      push(e->consequence, arena);
+      push(e->alternative, arena);
+    } else if (auto *taken{truthy ? e->consequence : e->alternative}) {
+      // Without a branch to take it evaluates to null, and stays
+      tasks.push_back({e, task.slot, &arena, 2});
+      push(taken, arena);
+    }
+    return;
+  default:
+    break;
+  }
+  literal_truth(e->condition, truthy);
+  auto *taken{truthy ? e->consequence : e->alternative};
+  // Blocks don't open a scope, so a lone expression can stand in for one
+  if (taken->statements.size() == 1 &&
+      taken->statements[0]->kind == NodeKind::ExpressionStatement) {
+    if (auto *value{
+            static_cast<ExpressionStatement *>(taken->statements[0])->value}) {
+      *task.slot = value;
+      return;
+    }
+  }
+  e->condition = boolean(arena, true);
+  e->consequence = taken;
+  e->alternative = nullptr;
+}
+
+void tail_block(BlockStatement *, bool);
+
+void tail_expression(Expression *e) {
+  switch (e ? generic_kind(e->kind) : NodeKind::Program) {
+  case NodeKind::CallExpression:
+    static_cast<CallExpression *>(e)->tail = true;
+    break;
+  case NodeKind::IfExpression: {
+    auto *i{static_cast<IfExpression *>(e)};
+    tail_block(i->consequence, true);
+    tail_block(i->alternative, true);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// Returns are tail calls wherever they are, the last statement only if the
+// block's value is the function's
+void tail_block(BlockStatement *b, bool last_is_tail) {
+  if (!b) {
+    return;
+  }
+  for (size_t i = 0; i < b->statements.size(); i++) {
+    auto *s{b->statements[i]};
+    auto last{last_is_tail && i + 1 == b->statements.size()};
+    if (s->kind == NodeKind::ReturnStatement) {
+      tail_expression(static_cast<ReturnStatement *>(s)->value);
+    } else if (s->kind == NodeKind::ExpressionStatement) {
+      auto *value{static_cast<ExpressionStatement *>(s)->value};
+      if (last) {
+        tail_expression(value);
+      } else if (value && value->kind == NodeKind::IfExpression) {
+        // Only for the returns in it
+        auto *i{static_cast<IfExpression *>(value)};
+        tail_block(i->consequence, false);
+        tail_block(i->alternative, false);
+      }
+    } else if (s->kind == NodeKind::BlockStatement) {
+      tail_block(static_cast<BlockStatement *>(s), last);
+    }
+  }
+}
+} // namespace
+
+void fold_constants(Program &program) {
+  Folder folder{};
+  for (auto *s : program.statements) {
+    folder.run(s, *program.arena);
+  }
+}
+
+void fold_constants(BlockStatement &block, AstArena &arena) {
+  Folder{}.run(&block, arena);
+}
+
+void mark_tail_calls(BlockStatement &body) { tail_block(&body, true); }
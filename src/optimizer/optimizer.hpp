@@ -0,0 +1,19 @@
+#pragma once
+#include "../ast/ast.hpp"
+
+// Constant folding, run between parsing and evaluation. Integer, boolean and
+// string operators whose operands are literals become literals, with the
+// evaluator's semantics, and ifs with a constant condition lose their dead
+// branch. Anything the evaluator would report as an error, and integer
+// arithmetic that would overflow, is left for it to run.
+//
+// Nodes are rewritten in place. New ones go into the arena of the function
+// (or program) they belong to, so closures keep them alive. Function bodies
+// that haven't been parsed yet are left alone.
+void fold_constants(Program &);
+void fold_constants(BlockStatement &, AstArena &);
+
+// Marks the calls whose value `body` returns as-is, in a `return` or as the
+// last expression of the body or of an if branch in that position, so the
+// evaluator can run them without growing the stack
+void mark_tail_calls(BlockStatement &body);
@@ -0,0 +1,363 @@
+#include "resolver.hpp"
+#include "optimizer.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace {
+struct FunctionScope {
+  FunctionLiteral *function;
+  std::vector<Symbol> locals{};
+  // How many params and lets bind each local
+  std::vector<uint32_t> declarations{};
+  // Bound once the body is done, when it is known which locals are captured
+  std::vector<std::vector<Identifier *>> uses{};
+  std::vector<bool> captured{};
+  // Whether a top-level let or the call has certainly assigned the local by
+  // the point the binding pass is at, and whether it is read anywhere before
+  std::vector<bool> assigned{};
+  std::vector<bool> read_early{};
+  std::vector<Symbol> capture_names{};
+  std::vector<Capture> captures{};
+};
+
+constexpr uint32_t NOT_FOUND{UINT32_MAX};
+
+uint32_t find(const std::vector<Symbol> &names, Symbol name) {
+  auto it{std::find(names.begin(), names.end(), name)};
+  return it == names.end() ? NOT_FOUND : it - names.begin();
+}
+
+// Walks a function body twice: once to find every name it binds, so uses
+// before the let still get its slot, then to bind the identifiers. Both
+// walks keep pending nodes on heap stacks instead of recursing, like the
+// parser and the evaluator, so nesting depth is only limited by memory.
+class Resolver {
+public:
+  void function(FunctionLiteral *);
+  void statement(Statement *);
+
+private:
+  struct Task {
+    enum class Kind : uint8_t {
+      Visit,
+      // After a top-level let of the current function: its name is assigned
+      Assigned,
+      // After the body of the current function
+      Leave,
+    };
+    Kind kind;
+    Node *node;
+  };
+  void run();
+  void visit(Node *);
+  void enter(FunctionLiteral *);
+  void leave(FunctionLiteral *);
+  void collect(BlockStatement *);
+  // Appends the statements and expressions directly in `n`, in order.
+  // Function bodies are left to enter().
+  static void children(Node *n, std::vector<Node *> &out);
+  uint32_t declare(Symbol);
+  void declare(Identifier &);
+  void reference(Identifier &);
+  uint32_t capture(size_t scope, Symbol);
+  static uint32_t add_capture(FunctionScope &, Symbol, Capture);
+  // Innermost last
+  std::vector<FunctionScope> scopes{};
+  std::vector<Task> tasks{};
+  std::vector<Node *> found{};
+  // The function literal the let being visited binds, if the let is its
+  // name's only binding in a function
+  FunctionLiteral *named{nullptr};
+  Symbol name{};
+};
+
+void Resolver::function(FunctionLiteral *f) {
+  enter(f);
+  run();
+}
+
+void Resolver::statement(Statement *s) {
+  tasks.push_back({Task::Kind::Visit, s});
+  run();
+}
+
+void Resolver::run() {
+  while (!tasks.empty()) {
+    auto [kind, n]{tasks.back()};
+    tasks.pop_back();
+    switch (kind) {
+    case Task::Kind::Visit:
+      visit(n);
+      break;
+    case Task::Kind::Assigned: {
+      auto &scope{scopes.back()};
+      auto &ident{static_cast<LetStatement *>(n)->identifier};
+      scope.assigned[find(scope.locals, ident.symbol)] = true;
+      break;
+    }
+    case Task::Kind::Leave:
+      leave(static_cast<FunctionLiteral *>(n));
+      break;
+    }
+  }
+}
+
+void Resolver::visit(Node *n) {
+  switch (n ? generic_kind(n->kind) : NodeKind::Program) {
+  case NodeKind::Program:
+    return;
+  case NodeKind::Identifier:
+    reference(*static_cast<Identifier *>(n));
+    return;
+  case NodeKind::FunctionLiteral: {
+    // Top-level functions capture nothing, so they can wait for their call.
+    // Its lets bind in its own scope.
+    auto *f{static_cast<FunctionLiteral *>(n)};
+    if (f->body_parsed() || !scopes.empty()) {
+      enter(f);
+    }
+    return;
+  }
+  case NodeKind::LetStatement: {
+    auto *let{static_cast<LetStatement *>(n)};
+    if (scopes.empty() || !let->value ||
+        let->value->kind != NodeKind::FunctionLiteral) {
+      break;
+    }
+    auto &scope{scopes.back()};
+    if (scope.declarations[find(scope.locals, let->identifier.symbol)] == 1) {
+      named = static_cast<FunctionLiteral *>(let->value);
+      name = let->identifier.symbol;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+  found.clear();
+  children(n, found);
+  for (auto it{found.rbegin()}; it != found.rend(); ++it) {
+    tasks.push_back({Task::Kind::Visit, *it});
+  }
+}
+
+// Declares the function's names and queues its body, then leave()
+void Resolver::enter(FunctionLiteral *f) {
+  auto fresh{!f->body_parsed()};
+  auto *body{f->body()};
+  if (f->resolved || !body) {
+    return;
+  }
+  if (fresh) {
+    fold_constants(*body, *f->arena);
+  }
+  mark_tail_calls(*body);
+  scopes.push_back({f});
+  for (auto &param : f->params) {
+    declare(param);
+  }
+  // Whatever the let's name is outside, it is this function while it runs
+  if (named == f && find(scopes.back().locals, name) == NOT_FOUND) {
+    f->self = declare(name);
+  }
+  named = nullptr;
+  scopes.back().assigned.assign(scopes.back().locals.size(), true);
+  collect(body);
+  tasks.push_back({Task::Kind::Leave, f});
+  auto &statements{body->statements};
+  for (auto it{statements.rbegin()}; it != statements.rend(); ++it) {
+    if ((*it)->kind == NodeKind::LetStatement) {
+      tasks.push_back({Task::Kind::Assigned, *it});
+    }
+    tasks.push_back({Task::Kind::Visit, *it});
+  }
+}
+
+void Resolver::leave(FunctionLiteral *f) {
+  auto &scope{scopes.back()};
+  // Reads before a let runs still mean the enclosing function's variable of
+  // that name, so such locals get a cell that falls back to it
+  std::vector<Shadow> shadows{};
+  for (uint32_t i = 0; i < scope.locals.size(); i++) {
+    if (!scope.read_early[i]) {
+      continue;
+    }
+    if (auto index{capture(scopes.size() - 1, scope.locals[i])};
+        index != NOT_FOUND) {
+      scope.captured[i] = true;
+      shadows.push_back({i, index});
+    }
+  }
+  std::vector<uint32_t> cells{};
+  for (uint32_t i = 0; i < scope.locals.size(); i++) {
+    auto binding{scope.captured[i] ? Identifier::Binding::Cell
+                                   : Identifier::Binding::Local};
+    for (auto *ident : scope.uses[i]) {
+      ident->binding = binding;
+      ident->slot = i;
+    }
+    if (scope.captured[i]) {
+      cells.push_back(i);
+    }
+  }
+  f->locals = f->arena->copy(scope.locals);
+  f->cells = f->arena->copy(cells);
+  f->captures = f->arena->copy(scope.captures);
+  f->shadows = f->arena->copy(shadows);
+  f->resolved = true;
+  scopes.pop_back();
+}
+
+// Declares every let in `body`, in order. Nested functions bind their own.
+void Resolver::collect(BlockStatement *body) {
+  std::vector<Node *> pending{body};
+  while (!pending.empty()) {
+    auto *n{pending.back()};
+    pending.pop_back();
+    if (!n || n->kind == NodeKind::FunctionLiteral) {
+      continue;
+    }
+    if (n->kind == NodeKind::LetStatement) {
+      declare(static_cast<LetStatement *>(n)->identifier);
+    }
+    found.clear();
+    children(n, found);
+    pending.insert(pending.end(), found.rbegin(), found.rend());
+  }
+}
+
+uint32_t Resolver::declare(Symbol name) {
+  auto &scope{scopes.back()};
+  auto slot{find(scope.locals, name)};
+  if (slot == NOT_FOUND) {
+    slot = scope.locals.size();
+    scope.locals.push_back(name);
+    scope.declarations.push_back(0);
+    scope.uses.emplace_back();
+    scope.captured.push_back(false);
+    scope.assigned.push_back(false);
+    scope.read_early.push_back(false);
+  }
+  scope.declarations[slot]++;
+  return slot;
+}
+
+void Resolver::declare(Identifier &ident) {
+  if (scopes.empty()) {
+    return;
+  }
+  scopes.back().uses[declare(ident.symbol)].push_back(&ident);
+}
+
+void Resolver::reference(Identifier &ident) {
+  ident.binding = Identifier::Binding::Global;
+  if (scopes.empty()) {
+    return;
+  }
+  auto &scope{scopes.back()};
+  if (auto slot{find(scope.locals, ident.symbol)}; slot != NOT_FOUND) {
+    scope.uses[slot].push_back(&ident);
+    scope.read_early[slot] = scope.read_early[slot] || !scope.assigned[slot];
+  } else if (auto index{capture(scopes.size() - 1, ident.symbol)};
+             index != NOT_FOUND) {
+    ident.binding = Identifier::Binding::Capture;
+    ident.slot = index;
+  }
+}
+
+// The index of `name` in the captures of scopes[scope], adding it and what it
+// is captured from in the functions outside. NOT_FOUND for globals. Looks
+// outwards for the nearest scope that has it, then threads it back inwards.
+uint32_t Resolver::capture(size_t scope, Symbol name) {
+  auto from{scope};
+  uint32_t index{};
+  while ((index = find(scopes[from].capture_names, name)) == NOT_FOUND) {
+    if (from == 0) {
+      return NOT_FOUND;
+    }
+    auto &outer{scopes[from - 1]};
+    if (auto slot{find(outer.locals, name)}; slot != NOT_FOUND) {
+      outer.captured[slot] = true;
+      outer.read_early[slot] = outer.read_early[slot] || !outer.assigned[slot];
+      index = add_capture(scopes[from], name, {true, slot});
+      break;
+    }
+    --from;
+  }
+  while (from < scope) {
+    index = add_capture(scopes[++from], name, {false, index});
+  }
+  return index;
+}
+
+uint32_t Resolver::add_capture(FunctionScope &scope, Symbol name,
+                               Capture from) {
+  scope.capture_names.push_back(name);
+  scope.captures.push_back(from);
+  return scope.captures.size() - 1;
+}
+
+void Resolver::children(Node *n, std::vector<Node *> &out) {
+  switch (generic_kind(n->kind)) {
+  case NodeKind::LetStatement:
+    out.push_back(static_cast<LetStatement *>(n)->value);
+    break;
+  case NodeKind::ReturnStatement:
+    out.push_back(static_cast<ReturnStatement *>(n)->value);
+    break;
+  case NodeKind::ExpressionStatement:
+    out.push_back(static_cast<ExpressionStatement *>(n)->value);
+    break;
+  case NodeKind::BlockStatement: {
+    auto &statements{static_cast<BlockStatement *>(n)->statements};
+    out.insert(out.end(), statements.begin(), statements.end());
+    break;
+  }
+  case NodeKind::PrefixExpression:
+    out.push_back(static_cast<PrefixExpression *>(n)->right);
+    break;
+  case NodeKind::InfixExpression: {
+    auto *infix{static_cast<InfixExpression *>(n)};
+    out.insert(out.end(), {infix->left, infix->right});
+    break;
+  }
+  case NodeKind::IfExpression: {
+    auto *i{static_cast<IfExpression *>(n)};
+    out.insert(out.end(), {i->condition, i->consequence, i->alternative});
+    break;
+  }
+  case NodeKind::ArrayLiteral: {
+    auto &elements{static_cast<ArrayLiteral *>(n)->elements};
+    out.insert(out.end(), elements.begin(), elements.end());
+    break;
+  }
+  case NodeKind::HashLiteral:
+    for (auto &[key, value] : static_cast<HashLiteral *>(n)->pairs) {
+      out.insert(out.end(), {key, value});
+    }
+    break;
+  case NodeKind::IndexExpression: {
+    auto *index{static_cast<IndexExpression *>(n)};
+    out.insert(out.end(), {index->left, index->index});
+    break;
+  }
+  case NodeKind::CallExpression: {
+    auto *call{static_cast<CallExpression *>(n)};
+    out.push_back(call->function);
+    out.insert(out.end(), call->arguments.begin(), call->arguments.end());
+    break;
+  }
+  default:
+    break;
+  }
+}
+} // namespace
+
+void resolve(Program &program) {
+  Resolver resolver{};
+  for (auto *s : program.statements) {
+    resolver.statement(s);
+  }
+}
+
+void resolve(FunctionLiteral &function) { Resolver{}.function(&function); }
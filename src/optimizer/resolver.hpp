@@ -0,0 +1,19 @@
+#pragma once
+#include "../ast/ast.hpp"
+
+// Lexical addressing and closure conversion. Every function gets a fixed
+// list of slots, for its parameters and every name it binds with let (blocks
+// don't open scopes), and every identifier is bound to one of them. Variables
+// a function uses from the functions it is nested in become its captures, and
+// the locals they come from are kept in cells that the closure shares with
+// the call that made it. Closures hold only those, not the scopes they were
+// made in.
+//
+// Top-level lets are globals and stay looked up by symbol, since later
+// programs can add more. Resolving a function also parses the lazy bodies of
+// the functions nested in it, since their captures have to be known when
+// they are created. Top-level functions capture nothing and keep theirs until
+// resolve(FunctionLiteral &) runs on the first call.
+void resolve(Program &);
+// Resolves a top-level function whose body has been parsed
+void resolve(FunctionLiteral &);
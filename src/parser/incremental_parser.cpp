@@ -0,0 +1,111 @@
+#include "incremental_parser.hpp"
+#include <algorithm>
+#include <iterator>
+
+namespace {
+// Lexes from `base` onwards and remembers the byte span of every token
+class SpanLexer : public TokenSource {
+public:
+  SpanLexer(std::string_view text, size_t base)
+      : lexer(Lexer::borrow(text.substr(base))), base(base),
+        length(text.length() - base) {}
+  virtual Token next_token() override {
+    auto tok{lexer.next_token()};
+    spans.emplace_back(base + lexer.token_start(),
+                       base + std::min(lexer.offset(), length));
+    return tok;
+  }
+  std::vector<std::pair<size_t, size_t>> spans{};
+
+private:
+  Lexer lexer;
+  size_t base;
+  size_t length;
+};
+} // namespace
+
+IncrementalParser::IncrementalParser(std::string text)
+    : source(std::move(text)) {
+  reparse(0, 0, 0, 0);
+}
+
+void IncrementalParser::edit(size_t offset, size_t removed,
+                             std::string_view inserted) {
+  offset = std::min(offset, source.length());
+  removed = std::min(removed, source.length() - offset);
+  source.replace(offset, removed, inserted);
+
+  // Tokens touching the edit can merge with the inserted text, hence the
+  // strict comparisons on both sides
+  size_t keep{0};
+  while (keep < statements.size() && statements[keep].lookahead_end < offset) {
+    ++keep;
+  }
+  size_t restart{keep > 0 ? statements[keep - 1].end : 0};
+  reparse(keep, restart, offset + removed,
+          static_cast<long>(inserted.length()) - static_cast<long>(removed));
+}
+
+void IncrementalParser::reparse(size_t keep, size_t restart,
+                                size_t resync_after, long delta) {
+  auto old{std::move(statements)};
+  statements.clear();
+  std::move(old.begin(), old.begin() + keep, std::back_inserter(statements));
+
+  auto lexer{std::make_unique<SpanLexer>(source, restart)};
+  auto &spans{lexer->spans};
+  Parser parser{std::move(lexer)};
+  size_t next_old{keep};
+  bool resynced{false};
+  last_reparsed = 0;
+  while (!parser.at_end()) {
+    auto begin{spans[parser.token_index()].first};
+    // Unsigned wrap-around makes `+ delta` right for statements past the edit
+    while (next_old < old.size() && (old[next_old].begin <= resync_after ||
+                                     old[next_old].begin + delta < begin)) {
+      ++next_old;
+    }
+    if (next_old < old.size() && old[next_old].begin + delta == begin) {
+      resynced = true;
+      break;
+    }
+
+    auto errors_before{parser.errors.size()};
+    auto statement{parser.parse_next()};
+    auto end{spans[parser.token_index() - 1].second};
+    auto lookahead_end{spans[parser.token_index()].second};
+    statements.push_back(ParsedStatement{
+        statement, parser.ast_arena(), begin, end, lookahead_end,
+        std::vector(parser.errors.begin() + errors_before,
+                    parser.errors.end())});
+    ++last_reparsed;
+  }
+
+  if (resynced) {
+    for (auto it{old.begin() + next_old}; it != old.end(); ++it) {
+      it->begin += delta;
+      it->end += delta;
+      it->lookahead_end += delta;
+      statements.push_back(std::move(*it));
+    }
+  }
+}
+
+std::shared_ptr<Program> IncrementalParser::program() const {
+  auto program{std::make_shared<Program>()};
+  for (const auto &s : statements) {
+    if (s.statement) {
+      program->statements.push_back(s.statement);
+      program->arena->retain(s.arena);
+    }
+  }
+  return program;
+}
+
+std::vector<std::string> IncrementalParser::errors() const {
+  std::vector<std::string> all{};
+  for (const auto &s : statements) {
+    all.insert(all.end(), s.errors.begin(), s.errors.end());
+  }
+  return all;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "parser.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Front end for an edited buffer. After an edit it re-lexes and re-parses
+// only the top-level statements the edit can have changed, and reuses the
+// other Statement subtrees from the previous Program.
+//
+// A statement's parse depends on its own tokens plus one token of lookahead,
+// so statements whose lookahead ends before the edit are kept as they are.
+// Re-parsing stops at the first statement start that lines up with an old
+// statement start past the edit: lexer and parser carry no state across that
+// boundary, so everything from there on parses the same as before.
+class IncrementalParser {
+public:
+  IncrementalParser(std::string text);
+  // Replaces `removed` bytes at `offset` with `inserted`
+  void edit(size_t offset, size_t removed, std::string_view inserted);
+  const std::string &text() const { return source; }
+  std::shared_ptr<Program> program() const;
+  std::vector<std::string> errors() const;
+  // Statements parsed by the last edit (or the initial parse)
+  size_t reparsed() const { return last_reparsed; }
+
+private:
+  struct ParsedStatement {
+    // nullptr when the statement failed to parse
+    Statement *statement;
+    // The arena of the parse that produced `statement`
+    std::shared_ptr<AstArena> arena;
+    size_t begin;
+    size_t end;
+    size_t lookahead_end;
+    std::vector<std::string> errors;
+  };
+  void reparse(size_t keep, size_t restart, size_t resync_after, long delta);
+  std::string source;
+  std::vector<ParsedStatement> statements{};
+  size_t last_reparsed{0};
+};
@@ -1,90 +1,182 @@
 #include "parser.hpp"
+#include <algorithm>
 #include <memory>
+#include <thread>
 
 using namespace token_types;
 
-Parser::Parser(Lexer l) : lexer(l) {
+Parser::Parser(Lexer l) : Parser(std::make_unique<Lexer>(std::move(l))) {}
+
+Parser::Parser(std::unique_ptr<TokenSource> l)
+    : Parser(std::move(l), nullptr) {}
+
+Parser::Parser(std::shared_ptr<const TokenBuffer> t)
+    : Parser(nullptr, std::move(t)) {}
+
+Parser::Parser(std::unique_ptr<TokenSource> l,
+               std::shared_ptr<const TokenBuffer> t, size_t first, size_t last,
+               std::shared_ptr<AstArena> a)
+    : lexer(std::move(l)), tokens(std::move(t)), first_token(first),
+      last_token(last), arena(a ? std::move(a) : std::make_shared<AstArena>()) {
   next_token();
   next_token();
-
-  register_prefix(Ident{}, &Parser::parse_identifier);
-  register_prefix(LParen{}, &Parser::parse_grouped_expression);
-  register_prefix(Int{}, &Parser::parse_integer_literal);
-  register_prefix(True{}, &Parser::parse_boolean_literal);
-  register_prefix(False{}, &Parser::parse_boolean_literal);
-  register_prefix(String{}, &Parser::parse_string_literal);
-  register_prefix(LSquarely{}, &Parser::parse_array_literal);
-  register_prefix(LSquirly{}, &Parser::parse_hash_literal);
-  register_prefix(Function{}, &Parser::parse_function_literal);
-  register_prefix(Bang{}, &Parser::parse_prefix_expression);
-  register_prefix(Minus{}, &Parser::parse_prefix_expression);
-  register_prefix(If{}, &Parser::parse_if_expression);
-
-  register_infix(Plus{}, &Parser::parse_infix_expression);
-  register_infix(Minus{}, &Parser::parse_infix_expression);
-  register_infix(Slash{}, &Parser::parse_infix_expression);
-  register_infix(Asterisk{}, &Parser::parse_infix_expression);
-  register_infix(Eq{}, &Parser::parse_infix_expression);
-  register_infix(NotEq{}, &Parser::parse_infix_expression);
-  register_infix(LT{}, &Parser::parse_infix_expression);
-  register_infix(GT{}, &Parser::parse_infix_expression);
-  register_infix(LParen{}, &Parser::parse_call_expression);
-  register_infix(LSquarely{}, &Parser::parse_index_expression);
-};
+}
 
 std::shared_ptr<Program> Parser::parse_program() {
-  auto program = std::make_shared<Program>();
-  while (!cur_token.is_type<Eof>()) {
-    auto statement{parse_statement()};
+  auto program = std::make_shared<Program>(arena);
+  while (!at_end()) {
+    auto statement{parse_next()};
     if (statement) {
-      program->statements.push_back(std::move(statement));
+      program->statements.push_back(statement);
     }
-    next_token();
   }
   return program;
 }
 
-void Parser::next_token() {
-  cur_token = peek_token;
-  peek_token = lexer.next_token();
+// {{{ Parallel parsing
+// Statements carry no parser state across a semicolon outside of any
+// brackets, so the slices between such semicolons parse exactly like they do
+// in one pass. Erroneous programs are the exception: recovery can read past a
+// statement's end, so any errors send the program back through the serial
+// parser to get the same messages.
+std::vector<size_t> statement_cuts(const TokenBuffer &tokens, size_t begin,
+                                   unsigned parts) {
+  std::vector<size_t> cuts{begin};
+  auto count{tokens.size()};
+  long depth{0};
+  size_t target{begin + (count - begin) / parts};
+  for (size_t i = begin; i < count && cuts.size() < parts; ++i) {
+    switch (tokens.kinds[i]) {
+    case TokenKind::LParen:
+    case TokenKind::LSquirly:
+    case TokenKind::LSquarely:
+      ++depth;
+      break;
+    case TokenKind::RParen:
+    case TokenKind::RSquirly:
+    case TokenKind::RSquarely:
+      --depth;
+      break;
+    case TokenKind::Semicolon:
+      if (depth == 0 && i >= target) {
+        cuts.push_back(i + 1);
+        target = begin + (count - begin) * cuts.size() / parts;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  cuts.push_back(count);
+  return cuts;
 }
 
-inline void Parser::register_prefix(TokenVariant t, PrefixParseFn fn) {
-  prefix_parse_fns.insert(std::make_pair(t, fn));
+std::shared_ptr<Program> Parser::parse_program_parallel(unsigned threads,
+                                                        size_t min_slice) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // Slices don't get sliced again
+  auto begin{token_index()};
+  if (!tokens || last_token != SIZE_MAX || first_token != 0) {
+    return parse_program();
+  }
+  auto slices{(tokens->size() - std::min(begin, tokens->size())) /
+              std::max<size_t>(min_slice, 1)};
+  threads = std::min<size_t>(threads, slices);
+  if (threads < 2) {
+    return parse_program();
+  }
+
+  auto cuts{statement_cuts(*tokens, begin, threads)};
+  auto parts{cuts.size() - 1};
+  std::vector<std::shared_ptr<Program>> programs(parts);
+  std::vector<uint8_t> failed(parts);
+  std::vector<std::thread> workers{};
+  for (size_t i = 0; i < parts; ++i) {
+    workers.emplace_back([&, i]() {
+      Parser slice{nullptr, tokens, cuts[i], cuts[i + 1]};
+      slice.explicit_stack = explicit_stack;
+      slice.lazy_functions = lazy_functions;
+      programs[i] = slice.parse_program();
+      failed[i] = !slice.errors.empty();
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  if (std::find(failed.begin(), failed.end(), 1) != failed.end()) {
+    return parse_program();
+  }
+
+  auto program{std::make_shared<Program>(arena)};
+  for (const auto &p : programs) {
+    program->statements.insert(program->statements.end(),
+                               p->statements.begin(), p->statements.end());
+    arena->retain(p->arena);
+  }
+  cursor = tokens->size() + 2;
+  cur_token = peek_token = Token{};
+  return program;
+}
+// }}}
+
+bool Parser::at_end() const { return cur_token.is_type<Eof>(); }
+
+Statement *Parser::parse_next() {
+  auto statement{parse_statement()};
+  next_token();
+  return statement;
 }
 
-inline void Parser::register_infix(TokenVariant t, InfixParseFn fn) {
-  infix_parse_fns.insert(std::make_pair(t, fn));
+void Parser::next_token() {
+  cur_token = std::move(peek_token);
+  if (tokens) {
+    auto index{first_token + cursor};
+    peek_token = index < last_token ? tokens->token(index) : Token{};
+  } else {
+    peek_token = lexer->next_token();
+  }
+  ++cursor;
+}
+
+void Parser::seek(size_t index) {
+  cursor = index - first_token;
+  next_token();
+  next_token();
 }
 
-std::vector<Identifier> Parser::parse_function_parameters() {
+std::span<Identifier> Parser::parse_function_parameters() {
   std::vector<Identifier> params{};
   if (peek_token.is_type<RParen>()) {
     next_token();
-    return params;
+    return {};
   }
-  next_token();
-  params.push_back(Identifier{std::get<Ident>(cur_token.value).literal});
+  if (!expect_peek<Ident>()) {
+    return {};
+  }
+  params.push_back(Identifier{cur_token.symbol()});
 
   while (peek_token.is_type<Comma>()) {
     next_token();
-    next_token();
-    params.push_back(Identifier{std::get<Ident>(cur_token.value).literal});
+    if (!expect_peek<Ident>()) {
+      return {};
+    }
+    params.push_back(Identifier{cur_token.symbol()});
   }
 
   if (!expect_peek<RParen>()) {
-    return std::vector<Identifier>{};
+    return {};
   }
 
-  return params;
+  return arena->copy(params);
 }
 
-template <typename T>
-std::vector<std::shared_ptr<Expression>> Parser::parse_expression_list() {
-  std::vector<std::shared_ptr<Expression>> args{};
+template <typename T> std::span<Expression *> Parser::parse_expression_list() {
+  std::vector<Expression *> args{};
   if (peek_token.is_type<T>()) {
     next_token();
-    return args;
+    return {};
   }
   next_token();
   args.push_back(parse_expression(Precedence::LOWEST));
@@ -96,13 +188,13 @@ std::vector<std::shared_ptr<Expression>> Parser::parse_expression_list() {
   }
 
   if (!expect_peek<T>()) {
-    return std::vector<std::shared_ptr<Expression>>{};
+    return {};
   }
 
-  return args;
+  return arena->copy(args);
 }
 
-std::shared_ptr<Statement> Parser::parse_statement() {
+Statement *Parser::parse_statement() {
   if (cur_token.is_type<Let>()) {
     return parse_let_statement();
   }
@@ -113,16 +205,16 @@ std::shared_ptr<Statement> Parser::parse_statement() {
   return parse_expression_statement();
 }
 
-std::shared_ptr<Statement> Parser::parse_expression_statement() {
+Statement *Parser::parse_expression_statement() {
   auto expr{parse_expression(Precedence::LOWEST)};
   if (peek_token.is_type<Semicolon>()) {
     next_token();
   }
 
-  return std::make_shared<ExpressionStatement>(std::move(expr));
+  return arena->make<ExpressionStatement>(expr);
 }
 
-std::shared_ptr<Statement> Parser::parse_return_statement() {
+Statement *Parser::parse_return_statement() {
   next_token();
 
   auto ret_val{parse_expression(Precedence::LOWEST)};
@@ -130,15 +222,15 @@ std::shared_ptr<Statement> Parser::parse_return_statement() {
     next_token();
   }
 
-  return std::make_shared<ReturnStatement>(ret_val);
+  return arena->make<ReturnStatement>(ret_val);
 }
 
-std::shared_ptr<Statement> Parser::parse_let_statement() {
+Statement *Parser::parse_let_statement() {
   if (!expect_peek<Ident>()) {
     return nullptr;
   }
 
-  Identifier identifier{std::get<Ident>(cur_token.value).literal};
+  Identifier identifier{cur_token.symbol()};
 
   if (!expect_peek<Assign>()) {
     return nullptr;
@@ -151,38 +243,115 @@ std::shared_ptr<Statement> Parser::parse_let_statement() {
     next_token();
   }
 
-  return std::make_shared<LetStatement>(identifier, std::move(value));
+  return arena->make<LetStatement>(identifier, value);
 }
 
-std::shared_ptr<BlockStatement> Parser::parse_block_statement() {
-  auto block = std::make_shared<BlockStatement>();
+BlockStatement *Parser::parse_block_statement() {
+  std::vector<Statement *> statements{};
   next_token();
   while (!cur_token.is_type<RSquirly>() && !cur_token.is_type<Eof>()) {
     auto statement{parse_statement()};
     if (statement) {
-      block->statements.push_back(std::move(statement));
+      statements.push_back(statement);
     }
     next_token();
   }
-  return block;
+  return arena->make<BlockStatement>(arena->copy(statements));
 }
 
-std::unordered_map<TokenVariant, Precedence> precedences{
-    {Eq{}, Precedence::EQUALS},      {NotEq{}, Precedence::EQUALS},
-    {LT{}, Precedence::LESSGREATER}, {GT{}, Precedence::LESSGREATER},
-    {Plus{}, Precedence::SUM},       {Minus{}, Precedence::SUM},
-    {Slash{}, Precedence::PRODUCT},  {Asterisk{}, Precedence::PRODUCT},
-    {LParen{}, Precedence::CALL},    {LSquarely{}, Precedence::INDEX}};
+// Leaves cur_token on the closing brace of the body, like
+// parse_block_statement(). Null if there is no buffer to come back to or the
+// braces don't match, so the body gets parsed right away.
+LazyBody *Parser::skip_function_body() {
+  if (!tokens) {
+    return nullptr;
+  }
+  auto begin{first_token + token_index()};
+  auto end{std::min(last_token, tokens->size())};
+  size_t depth{0};
+  for (auto i{begin}; i < end; ++i) {
+    if (tokens->kinds[i] == TokenKind::LSquirly) {
+      ++depth;
+    } else if (tokens->kinds[i] == TokenKind::RSquirly && --depth == 0) {
+      seek(i);
+      arena->retain(tokens);
+      return arena->make<LazyBody>(LazyBody{&Parser::parse_lazy_body,
+                                            tokens.get(), begin, i + 1,
+                                            explicit_stack, {}});
+    }
+  }
+  return nullptr;
+}
 
-Precedence get_precedence(TokenVariant v) {
-  return precedences.count(v) > 0 ? precedences[v] : Precedence::LOWEST;
+BlockStatement *Parser::parse_lazy_body(LazyBody &lazy, AstArena &arena) {
+  // Not owning: the arena already keeps the tokens alive
+  std::shared_ptr<const TokenBuffer> tokens{std::shared_ptr<void>{},
+                                            lazy.tokens};
+  Parser parser{nullptr, std::move(tokens), lazy.begin, lazy.end,
+                arena.shared_from_this()};
+  parser.explicit_stack = lazy.explicit_stack;
+  parser.lazy_functions = true;
+  auto body{parser.parse_block_statement()};
+  if (!parser.errors.empty()) {
+    lazy.error = arena.copy(parser.errors.front());
+    return nullptr;
+  }
+  return body;
 }
 
-Precedence Parser::peek_predence() { return get_precedence(peek_token.value); }
-Precedence Parser::cur_predence() { return get_precedence(cur_token.value); }
+constexpr Parser::ParseRules Parser::make_rules() {
+  ParseRules r{};
+  for (auto &p : r.precedence) {
+    p = Precedence::LOWEST;
+  }
+  auto prefix{[&r](TokenKind k, PrefixParseFn fn) {
+    r.prefix[kind_index(k)] = fn;
+  }};
+  auto infix{[&r](TokenKind k, InfixParseFn fn, Precedence p) {
+    r.infix[kind_index(k)] = fn;
+    r.precedence[kind_index(k)] = p;
+  }};
+
+  prefix(Ident{}, &Parser::parse_identifier);
+  prefix(LParen{}, &Parser::parse_grouped_expression);
+  prefix(Int{}, &Parser::parse_integer_literal);
+  prefix(True{}, &Parser::parse_boolean_literal);
+  prefix(False{}, &Parser::parse_boolean_literal);
+  prefix(String{}, &Parser::parse_string_literal);
+  prefix(LSquarely{}, &Parser::parse_array_literal);
+  prefix(LSquirly{}, &Parser::parse_hash_literal);
+  prefix(Function{}, &Parser::parse_function_literal);
+  prefix(Bang{}, &Parser::parse_prefix_expression);
+  prefix(Minus{}, &Parser::parse_prefix_expression);
+  prefix(If{}, &Parser::parse_if_expression);
+
+  infix(Plus{}, &Parser::parse_infix_expression, Precedence::SUM);
+  infix(Minus{}, &Parser::parse_infix_expression, Precedence::SUM);
+  infix(Slash{}, &Parser::parse_infix_expression, Precedence::PRODUCT);
+  infix(Asterisk{}, &Parser::parse_infix_expression, Precedence::PRODUCT);
+  infix(Eq{}, &Parser::parse_infix_expression, Precedence::EQUALS);
+  infix(NotEq{}, &Parser::parse_infix_expression, Precedence::EQUALS);
+  infix(LT{}, &Parser::parse_infix_expression, Precedence::LESSGREATER);
+  infix(GT{}, &Parser::parse_infix_expression, Precedence::LESSGREATER);
+  infix(LParen{}, &Parser::parse_call_expression, Precedence::CALL);
+  infix(LSquarely{}, &Parser::parse_index_expression, Precedence::INDEX);
+  return r;
+}
 
-std::shared_ptr<Expression> Parser::parse_expression(Precedence precedence) {
-  auto prefix{prefix_parse_fns[cur_token.value]};
+constexpr Parser::ParseRules Parser::rules{make_rules()};
+
+Precedence Parser::peek_predence() {
+  return rules.precedence[kind_index(peek_token.kind)];
+}
+Precedence Parser::cur_predence() {
+  return rules.precedence[kind_index(cur_token.kind)];
+}
+
+Expression *Parser::parse_expression(Precedence precedence) {
+  if (explicit_stack) {
+    return parse_expression_iterative(precedence);
+  }
+  auto prefix{rules.prefix[kind_index(cur_token.kind)]};
   if (!prefix) {
     errors.push_back("no prefix parse function for " + cur_token.to_string() +
                      " found");
@@ -191,41 +360,211 @@ std::shared_ptr<Expression> Parser::parse_expression(Precedence precedence) {
   auto left_exp{(this->*prefix)()};
 
   while (!peek_token.is_type<Semicolon>() && precedence < peek_predence()) {
-    auto infix{infix_parse_fns[peek_token.value]};
+    auto infix{rules.infix[kind_index(peek_token.kind)]};
     if (!infix) {
       return left_exp;
     }
     next_token();
-    left_exp = (this->*infix)(std::move(left_exp));
+    left_exp = (this->*infix)(left_exp);
   }
 
   return left_exp;
 }
 
-std::shared_ptr<Expression> Parser::parse_identifier() {
-  return std::make_shared<Identifier>(std::get<Ident>(cur_token.value).literal);
+// {{{ Explicit-stack expression parsing
+// The recursive parser above, turned inside out. Operand steps start the
+// construct at cur_token, pushing a frame whenever it needs a sub-expression;
+// operator steps run the infix loop of the innermost frame; reduce steps hand
+// a finished sub-expression to its frame. Function literals and if
+// expressions still go through their recursive parse functions: only
+// expression nesting gets deep in practice.
+Expression *Parser::parse_expression_iterative(Precedence precedence) {
+  enum class Step { Operand, Operators, Reduce };
+  using Kind = Frame::Kind;
+  auto bottom{frames.size()};
+  auto step{Step::Operand};
+  Expression *left{};
+  auto push{[&](Kind kind, Precedence p, Expression *held) {
+    frames.push_back(Frame{kind, cur_token.kind, p, held, operands.size()});
+    next_token();
+    step = Step::Operand;
+  }};
+
+  for (;;) {
+    switch (step) {
+    case Step::Operand:
+      step = Step::Operators;
+      switch (cur_token.kind) {
+      case TokenKind::Bang:
+      case TokenKind::Minus:
+        push(Kind::Prefix, Precedence::PREFIX, nullptr);
+        break;
+      case TokenKind::LParen:
+        push(Kind::Group, Precedence::LOWEST, nullptr);
+        break;
+      case TokenKind::LSquarely:
+        if (peek_token.is_type<RSquarely>()) {
+          next_token();
+          left = arena->make<ArrayLiteral>(std::span<Expression *>{});
+        } else {
+          push(Kind::Array, Precedence::LOWEST, nullptr);
+        }
+        break;
+      case TokenKind::LSquirly:
+        if (peek_token.is_type<RSquirly>()) {
+          next_token();
+          left = arena->make<HashLiteral>(std::span<HashLiteral::Pair>{});
+        } else {
+          push(Kind::HashKey, Precedence::LOWEST, nullptr);
+        }
+        break;
+      default:
+        if (auto prefix{rules.prefix[kind_index(cur_token.kind)]}) {
+          left = (this->*prefix)();
+        } else {
+          errors.push_back("no prefix parse function for " +
+                           cur_token.to_string() + " found");
+          left = nullptr;
+          step = Step::Reduce;
+        }
+        break;
+      }
+      break;
+
+    case Step::Operators: {
+      auto level{frames.size() > bottom ? frames.back().precedence
+                                        : precedence};
+      step = Step::Reduce;
+      while (!peek_token.is_type<Semicolon>() && level < peek_predence()) {
+        if (!rules.infix[kind_index(peek_token.kind)]) {
+          break;
+        }
+        next_token();
+        if (cur_token.is_type<LParen>()) {
+          if (!peek_token.is_type<RParen>()) {
+            push(Kind::Call, Precedence::LOWEST, left);
+            break;
+          }
+          next_token();
+          left = arena->make<CallExpression>(left, std::span<Expression *>{});
+        } else if (cur_token.is_type<LSquarely>()) {
+          push(Kind::Index, Precedence::LOWEST, left);
+          break;
+        } else {
+          push(Kind::Infix, cur_predence(), left);
+          break;
+        }
+      }
+      break;
+    }
+
+    case Step::Reduce: {
+      if (frames.size() == bottom) {
+        return left;
+      }
+      auto &frame{frames.back()};
+      step = Step::Operators;
+      switch (frame.kind) {
+      case Kind::Prefix:
+        left = arena->make<PrefixExpression>(frame.oper, left);
+        break;
+      case Kind::Infix:
+        left = arena->make<InfixExpression>(frame.left, frame.oper, left);
+        break;
+      case Kind::Group:
+        if (!expect_peek<RParen>()) {
+          left = nullptr;
+        }
+        break;
+      case Kind::Index:
+        left = expect_peek<RSquarely>()
+                   ? arena->make<IndexExpression>(frame.left, left)
+                   : nullptr;
+        break;
+      case Kind::Array:
+      case Kind::Call: {
+        operands.push_back(left);
+        if (peek_token.is_type<Comma>()) {
+          next_token();
+          next_token();
+          step = Step::Operand;
+          break;
+        }
+        std::span<Expression *> items{};
+        if (frame.kind == Kind::Array ? expect_peek<RSquarely>()
+                                      : expect_peek<RParen>()) {
+          items = arena->copy(std::vector<Expression *>(
+              operands.begin() + frame.base, operands.end()));
+        }
+        left = frame.kind == Kind::Array
+                   ? static_cast<Expression *>(arena->make<ArrayLiteral>(items))
+                   : arena->make<CallExpression>(frame.left, items);
+        break;
+      }
+      case Kind::HashKey:
+        operands.push_back(left);
+        left = nullptr;
+        if (expect_peek<Colon>()) {
+          next_token();
+          frame.kind = Kind::HashValue;
+          step = Step::Operand;
+        }
+        break;
+      case Kind::HashValue: {
+        operands.push_back(left);
+        left = nullptr;
+        if (!peek_token.is_type<RSquirly>() && !expect_peek<Comma>()) {
+          break;
+        }
+        if (!peek_token.is_type<RSquirly>()) {
+          next_token();
+          frame.kind = Kind::HashKey;
+          step = Step::Operand;
+          break;
+        }
+        next_token();
+        std::vector<HashLiteral::Pair> pairs{};
+        for (auto i{frame.base}; i < operands.size(); i += 2) {
+          pairs.emplace_back(operands[i], operands[i + 1]);
+        }
+        left = arena->make<HashLiteral>(arena->copy(pairs));
+        break;
+      }
+      }
+      if (step == Step::Operators) {
+        operands.resize(frame.base);
+        frames.pop_back();
+      }
+      break;
+    }
+    }
+  }
+}
+// }}}
+
+Expression *Parser::parse_identifier() {
+  return arena->make<Identifier>(cur_token.symbol());
 }
 
-std::shared_ptr<Expression> Parser::parse_integer_literal() {
-  return std::make_shared<IntegerLiteral>(std::get<Int>(cur_token.value).value);
+Expression *Parser::parse_integer_literal() {
+  return arena->make<IntegerLiteral>(cur_token.int_value());
 }
 
-std::shared_ptr<Expression> Parser::parse_boolean_literal() {
-  return std::make_shared<BooleanLiteral>(cur_token.is_type<True>());
+Expression *Parser::parse_boolean_literal() {
+  return arena->make<BooleanLiteral>(cur_token.is_type<True>());
 }
 
-std::shared_ptr<Expression> Parser::parse_string_literal() {
-  return std::make_shared<StringLiteral>(
-      std::get<String>(cur_token.value).value);
+Expression *Parser::parse_string_literal() {
+  // Token payloads don't outlive the source (or the stream buffer)
+  return arena->make<StringLiteral>(arena->copy(cur_token.string_value()));
 }
 
-std::shared_ptr<Expression> Parser::parse_array_literal() {
-  return std::make_shared<ArrayLiteral>(parse_expression_list<RSquarely>());
+Expression *Parser::parse_array_literal() {
+  return arena->make<ArrayLiteral>(parse_expression_list<RSquarely>());
 }
 
-std::shared_ptr<Expression> Parser::parse_hash_literal() {
-  std::unordered_map<std::shared_ptr<Expression>, std::shared_ptr<Expression>>
-      pairs;
+Expression *Parser::parse_hash_literal() {
+  std::vector<HashLiteral::Pair> pairs{};
 
   while (!peek_token.is_type<RSquirly>()) {
     next_token();
@@ -235,7 +574,7 @@ std::shared_ptr<Expression> Parser::parse_hash_literal() {
     }
     next_token();
     auto value{parse_expression(Precedence::LOWEST)};
-    pairs[key] = value;
+    pairs.emplace_back(key, value);
 
     if (!peek_token.is_type<RSquirly>() && !expect_peek<Comma>()) {
       return nullptr;
@@ -246,10 +585,10 @@ std::shared_ptr<Expression> Parser::parse_hash_literal() {
     return nullptr;
   }
 
-  return std::make_shared<HashLiteral>(pairs);
+  return arena->make<HashLiteral>(arena->copy(pairs));
 }
 
-std::shared_ptr<Expression> Parser::parse_function_literal() {
+Expression *Parser::parse_function_literal() {
   if (!expect_peek<LParen>()) {
     return nullptr;
   }
@@ -257,11 +596,14 @@ std::shared_ptr<Expression> Parser::parse_function_literal() {
   if (!expect_peek<LSquirly>()) {
     return nullptr;
   }
+  if (auto *lazy{lazy_functions ? skip_function_body() : nullptr}) {
+    return arena->make<FunctionLiteral>(params, lazy, arena.get());
+  }
   auto body{parse_block_statement()};
-  return std::make_shared<FunctionLiteral>(params, std::move(body));
+  return arena->make<FunctionLiteral>(params, body, arena.get());
 }
 
-std::shared_ptr<Expression> Parser::parse_if_expression() {
+Expression *Parser::parse_if_expression() {
   if (!expect_peek<LParen>()) {
     return nullptr;
   }
@@ -274,7 +616,7 @@ std::shared_ptr<Expression> Parser::parse_if_expression() {
     return nullptr;
   }
   auto consequence{parse_block_statement()};
-  std::shared_ptr<BlockStatement> alternative{};
+  BlockStatement *alternative{};
   if (peek_token.is_type<Else>()) {
     next_token();
     if (!expect_peek<LSquirly>()) {
@@ -283,11 +625,10 @@ std::shared_ptr<Expression> Parser::parse_if_expression() {
     alternative = parse_block_statement();
   }
 
-  return std::make_shared<IfExpression>(
-      std::move(condition), std::move(consequence), std::move(alternative));
+  return arena->make<IfExpression>(condition, consequence, alternative);
 }
 
-std::shared_ptr<Expression> Parser::parse_grouped_expression() {
+Expression *Parser::parse_grouped_expression() {
   next_token();
   auto expr{parse_expression(Precedence::LOWEST)};
   if (!expect_peek<RParen>()) {
@@ -296,36 +637,31 @@ std::shared_ptr<Expression> Parser::parse_grouped_expression() {
   return expr;
 }
 
-std::shared_ptr<Expression> Parser::parse_prefix_expression() {
-  auto oper{cur_token.value};
+Expression *Parser::parse_prefix_expression() {
+  auto oper{cur_token.kind};
   next_token();
   auto right{parse_expression(Precedence::PREFIX)};
-  return std::make_shared<PrefixExpression>(oper, std::move(right));
+  return arena->make<PrefixExpression>(oper, right);
 }
 
-std::shared_ptr<Expression>
-Parser::parse_infix_expression(std::shared_ptr<Expression> left) {
-  auto oper{cur_token.value};
+Expression *Parser::parse_infix_expression(Expression *left) {
+  auto oper{cur_token.kind};
   auto precedence{cur_predence()};
   next_token();
   auto right{parse_expression(precedence)};
 
-  return std::make_shared<InfixExpression>(std::move(left), oper,
-                                           std::move(right));
+  return arena->make<InfixExpression>(left, oper, right);
 }
 
-std::shared_ptr<Expression>
-Parser::parse_call_expression(std::shared_ptr<Expression> caller) {
-  return std::make_shared<CallExpression>(std::move(caller),
-                                          parse_expression_list<RParen>());
+Expression *Parser::parse_call_expression(Expression *caller) {
+  return arena->make<CallExpression>(caller, parse_expression_list<RParen>());
 }
 
-std::shared_ptr<Expression>
-Parser::parse_index_expression(std::shared_ptr<Expression> left) {
+Expression *Parser::parse_index_expression(Expression *left) {
   next_token();
   auto index{parse_expression(Precedence::LOWEST)};
   if (!expect_peek<RSquarely>()) {
     return nullptr;
   }
-  return std::make_shared<IndexExpression>(std::move(left), std::move(index));
+  return arena->make<IndexExpression>(left, index);
 }
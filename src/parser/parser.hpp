@@ -1,20 +1,7 @@
 #pragma once
 #include "../ast/ast.hpp"
 #include "../lexer/lexer.hpp"
-#include <unordered_map>
-
-namespace std {
-template <> struct hash<token_types::TokenVariant> {
-  std::size_t operator()(const token_types::TokenVariant &k) const {
-    return std::visit(
-        [](auto &&arg) {
-          return std::hash<std::string>()(
-              type_string<std::decay_t<decltype(arg)>>());
-        },
-        k);
-  }
-};
-} // namespace std
+#include <cstdint>
 
 enum class Precedence {
   _ = 0,
@@ -30,62 +17,130 @@ enum class Precedence {
 
 class Parser;
 
-typedef std::shared_ptr<Expression> (Parser::*PrefixParseFn)(void);
-typedef std::shared_ptr<Expression> (Parser::*InfixParseFn)(
-    std::shared_ptr<Expression>);
+typedef Expression *(Parser::*PrefixParseFn)(void);
+typedef Expression *(Parser::*InfixParseFn)(
+    Expression *);
 
 class Parser {
 public:
   Parser(Lexer);
+  Parser(std::unique_ptr<TokenSource>);
+  // Parses a pre-lexed buffer, reading tokens by index
+  Parser(std::shared_ptr<const TokenBuffer>);
   std::shared_ptr<Program> parse_program();
+  // Same result as parse_program(), but a pre-lexed buffer is cut after
+  // top-level semicolons into up to `threads` slices that are parsed in
+  // parallel. Buffers with fewer than `min_slice` tokens per thread, and
+  // parsers reading from a TokenSource, are parsed serially. `threads` = 0
+  // uses every hardware thread.
+  std::shared_ptr<Program> parse_program_parallel(unsigned threads = 0,
+                                                  size_t min_slice = 16 * 1024);
+  // Where the parsed nodes live. parse_program() hands it to the Program, so
+  // parse_next() callers hold on to it themselves.
+  const std::shared_ptr<AstArena> &ast_arena() const { return arena; }
+  // Statement-at-a-time parsing for callers that track where each top-level
+  // statement sits in the token stream
+  bool at_end() const;
+  // Parses the statement at the current token and moves past it. Returns
+  // nullptr if the statement could not be parsed.
+  Statement *parse_next();
+  // Number of tokens before the current one
+  size_t token_index() const { return cursor - 2; }
   std::vector<std::string> errors{};
+  // Parse expressions with a heap-allocated stack instead of recursing once
+  // per nesting level, for machine-generated input nested millions deep.
+  // Builds the same AST and reports the same errors as the recursive parser.
+  bool explicit_stack{false};
+  // Only brace-match function bodies in a token buffer and parse them the
+  // first time they are needed. Syntax errors in a body then surface when
+  // the function is applied instead of here.
+  bool lazy_functions{false};
 
 private:
+  // Nodes go into `arena`, or a new one if it's null
+  Parser(std::unique_ptr<TokenSource>, std::shared_ptr<const TokenBuffer>,
+         size_t first = 0, size_t last = SIZE_MAX,
+         std::shared_ptr<AstArena> arena = nullptr);
   void next_token();
+  // Buffer mode only: makes the token at `index` the current one
+  void seek(size_t index);
   template <typename TokenType> bool expect_peek();
   template <typename TokenType> void peek_error(Token);
   // Statements
-  std::shared_ptr<Statement> parse_statement();
-  std::shared_ptr<Statement> parse_let_statement();
-  std::shared_ptr<Statement> parse_return_statement();
-  std::shared_ptr<Statement> parse_expression_statement();
-  std::shared_ptr<BlockStatement> parse_block_statement();
+  Statement *parse_statement();
+  Statement *parse_let_statement();
+  Statement *parse_return_statement();
+  Statement *parse_expression_statement();
+  BlockStatement *parse_block_statement();
+  LazyBody *skip_function_body();
+  static BlockStatement *parse_lazy_body(LazyBody &, AstArena &);
 
   // Expressions
-  std::shared_ptr<Expression> parse_expression(Precedence);
-  std::shared_ptr<Expression> parse_identifier();
-  std::shared_ptr<Expression> parse_integer_literal();
-  std::shared_ptr<Expression> parse_boolean_literal();
-  std::shared_ptr<Expression> parse_string_literal();
-  std::shared_ptr<Expression> parse_array_literal();
-  std::shared_ptr<Expression> parse_hash_literal();
-  std::shared_ptr<Expression> parse_function_literal();
-  std::shared_ptr<Expression> parse_if_expression();
-  std::shared_ptr<Expression> parse_grouped_expression();
-  std::shared_ptr<Expression> parse_prefix_expression();
-  std::shared_ptr<Expression>
-      parse_infix_expression(std::shared_ptr<Expression>);
-  std::shared_ptr<Expression>
-      parse_call_expression(std::shared_ptr<Expression>);
-  std::shared_ptr<Expression>
-      parse_index_expression(std::shared_ptr<Expression>);
+  Expression *parse_expression(Precedence);
+  Expression *parse_identifier();
+  Expression *parse_integer_literal();
+  Expression *parse_boolean_literal();
+  Expression *parse_string_literal();
+  Expression *parse_array_literal();
+  Expression *parse_hash_literal();
+  Expression *parse_function_literal();
+  Expression *parse_if_expression();
+  Expression *parse_grouped_expression();
+  Expression *parse_prefix_expression();
+  Expression *parse_infix_expression(Expression *);
+  Expression *parse_call_expression(Expression *);
+  Expression *parse_index_expression(Expression *);
+
+  std::span<Identifier> parse_function_parameters();
+  template <typename T> std::span<Expression *> parse_expression_list();
 
-  std::vector<Identifier> parse_function_parameters();
-  template <typename T>
-  std::vector<std::shared_ptr<Expression>> parse_expression_list();
+  // One frame per parse_expression() call the recursive parser would have
+  // on the C++ stack, waiting for the operand it is parsing
+  struct Frame {
+    enum class Kind : uint8_t {
+      Prefix,
+      Infix,
+      Group,
+      Array,
+      Call,
+      Index,
+      HashKey,
+      HashValue,
+    };
+    Kind kind;
+    TokenKind oper;
+    // Of the operand being parsed
+    Precedence precedence;
+    // Infix left operand, callee or indexed expression
+    Expression *left;
+    // Where this frame's list elements start in `operands`
+    size_t base;
+  };
+  Expression *parse_expression_iterative(Precedence);
+  std::vector<Frame> frames{};
+  std::vector<Expression *> operands{};
 
-  void register_prefix(token_types::TokenVariant, PrefixParseFn);
-  void register_infix(token_types::TokenVariant, InfixParseFn);
+  // Pratt tables indexed by token kind, filled in at compile time
+  struct ParseRules {
+    PrefixParseFn prefix[TOKEN_KIND_COUNT]{};
+    InfixParseFn infix[TOKEN_KIND_COUNT]{};
+    Precedence precedence[TOKEN_KIND_COUNT]{};
+  };
+  static constexpr ParseRules make_rules();
+  static const ParseRules rules;
 
   Precedence peek_predence();
   Precedence cur_predence();
 
   Token cur_token;
   Token peek_token;
-  Lexer lexer;
-  std::unordered_map<token_types::TokenVariant, PrefixParseFn>
-      prefix_parse_fns{};
-  std::unordered_map<token_types::TokenVariant, InfixParseFn> infix_parse_fns{};
+  std::unique_ptr<TokenSource> lexer;
+  std::shared_ptr<const TokenBuffer> tokens;
+  // The slice of `tokens` this parser reads
+  size_t first_token;
+  size_t last_token;
+  size_t cursor{0};
+  std::shared_ptr<AstArena> arena;
 };
 
 template <typename TokenType> void Parser::peek_error(Token t) {
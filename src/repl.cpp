@@ -1,9 +1,16 @@
+#include "ast/ast_image.hpp"
 #include "evaluator/evaluator.hpp"
 #include "lexer/lexer.hpp"
+#include "lexer/stream_lexer.hpp"
 #include "object/environment.hpp"
+#include "optimizer/optimizer.hpp"
+#include "optimizer/resolver.hpp"
 #include "parser/parser.hpp"
+#include <charconv>
+#include <cstdlib>
 #include <iostream>
 #include <sstream>
+#include <unistd.h>
 #include <variant>
 #include <vector>
 
@@ -26,6 +33,15 @@ const std::string_view MONKEY_FACE = R"(            __,__
            '-----'
   )";
 
+void print_parser_errors(const std::vector<std::string> &errors) {
+  std::cout << MONKEY_FACE;
+  std::cout << "Woops! We can into some monkey business here!" << std::endl;
+  std::cout << "parser errors:" << std::endl;
+  for (auto &e : errors) {
+    std::cout << '\t' << e << std::endl;
+  }
+}
+
 void parse() {
   print_prompt();
   auto env{std::make_shared<Environment>()};
@@ -33,14 +49,11 @@ void parse() {
     Parser parser{Lexer{line}};
     auto program{parser.parse_program()};
     if (parser.errors.size() > 0) {
-      std::cout << MONKEY_FACE;
-      std::cout << "Woops! We can into some monkey business here!" << std::endl;
-      std::cout << "parser errors:" << std::endl;
-      for (auto &e : parser.errors) {
-        std::cout << '\t' << e << std::endl;
-      }
+      print_parser_errors(parser.errors);
     } else {
-      auto evaluated{eval(std::move(program), env)};
+      fold_constants(*program);
+      resolve(*program);
+      auto evaluated{eval(program.get(), env)};
       if (evaluated) {
         std::cout << evaluated->inspect() << std::endl;
       }
@@ -49,7 +62,83 @@ void parse() {
   }
 }
 
-int main() {
+// Scripts run on the explicit stack, so deep recursion ends in an error
+// instead of a crash. MONKEY_MAX_DEPTH overrides how deep calls can go,
+// anything but a positive number keeps the default.
+size_t max_depth() {
+  auto *env{std::getenv("MONKEY_MAX_DEPTH")};
+  std::string_view limit{env ? env : ""};
+  size_t depth{0};
+  auto [end, ec]{
+      std::from_chars(limit.data(), limit.data() + limit.size(), depth)};
+  if (ec != std::errc{} || end != limit.data() + limit.size() || depth == 0) {
+    return DEFAULT_MAX_DEPTH;
+  }
+  return depth;
+}
+
+int run(Program &program) {
+  fold_constants(program);
+  resolve(program);
+  auto evaluated{eval_explicit_stack(
+      &program, std::make_shared<Environment>(), max_depth())};
+  if (evaluated && evaluated->type() == ObjectType::ERROR_OBJ) {
+    std::cout << evaluated->inspect() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int run(Parser &parser) {
+  auto program{parser.parse_program()};
+  if (parser.errors.size() > 0) {
+    print_parser_errors(parser.errors);
+    return 1;
+  }
+  return run(*program);
+}
+
+int run_file(const std::string &path) {
+  // "-" streams the program from stdin instead of reading it up front
+  if (path == "-") {
+    Parser parser{std::make_unique<StreamLexer>(STDIN_FILENO)};
+    return run(parser);
+  }
+  auto source{Source::map_file(path)};
+  if (!source) {
+    std::cerr << "could not open " << path << std::endl;
+    return 1;
+  }
+  if (source->view().length() > TokenBuffer::MAX_SOURCE_SIZE) {
+    std::cerr << path << " is over 4GiB, stream it from stdin with -"
+              << std::endl;
+    return 1;
+  }
+  // A precompiled image next to the script skips lexing and parsing
+  auto image_path{ast_image::path_for(path)};
+  if (auto program{ast_image::load(image_path, source->view())}) {
+    return run(*program);
+  }
+  auto tokens{Lexer{source}.tokenize_parallel()};
+  Parser parser{std::make_shared<TokenBuffer>(std::move(tokens))};
+  parser.explicit_stack = true;
+  parser.lazy_functions = true;
+  auto program{parser.parse_program_parallel()};
+  if (parser.errors.size() > 0) {
+    print_parser_errors(parser.errors);
+    return 1;
+  }
+  // Writing the image parses the bodies that never ran, so leave it until
+  // the script is done
+  auto status{run(*program)};
+  ast_image::write(*program, source->view(), image_path);
+  return status;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1) {
+    return run_file(argv[1]);
+  }
   srand(time(0));
   parse();
   std::cout << std::endl;
@@ -1,22 +1,33 @@
 #include "test.hpp"
 
 #include "ast/ast.hpp"
+#include "ast/ast_image.hpp"
+#include "parser/parser.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
 
 bool test_string();
+bool test_arena();
+bool test_ast_image();
+bool test_node_kinds();
 
 int main() {
   bool pass{true};
   TEST(test_string, pass);
+  TEST(test_arena, pass);
+  TEST(test_ast_image, pass);
+  TEST(test_node_kinds, pass);
   return pass ? 0 : 1;
 }
 
 bool test_string() {
   Identifier lhs{"myVar"};
   Identifier rhs{"anotherVar"};
-  auto let_statement{
-      std::make_shared<LetStatement>(lhs, std::make_shared<Identifier>(rhs))};
   Program program{};
-  program.statements.push_back(std::move(let_statement));
+  auto let_statement{program.arena->make<LetStatement>(
+      lhs, program.arena->make<Identifier>(rhs))};
+  program.statements.push_back(let_statement);
   std::string prog{program.to_string()};
   if (prog != "let myVar = anotherVar;") {
     std::cout << "program.to_string() wrong. got " << prog << std::endl;
@@ -25,3 +36,197 @@ bool test_string() {
 
   return true;
 };
+
+bool test_arena() {
+  auto arena{std::make_shared<AstArena>()};
+  arena->make<BooleanLiteral>(true);
+  auto *number{arena->make<IntegerLiteral>(5)};
+  if (reinterpret_cast<uintptr_t>(number) % alignof(IntegerLiteral) != 0) {
+    std::cout << "arena node misaligned" << std::endl;
+    return false;
+  }
+  // Bigger than a block
+  std::vector<Expression *> many(100000, number);
+  auto elements{arena->copy(many)};
+  auto text{arena->copy(std::string_view{"hello"})};
+  if (elements.size() != many.size() || elements.back() != number ||
+      text != "hello" || number->value != 5) {
+    std::cout << "arena contents wrong" << std::endl;
+    return false;
+  }
+
+  // Objects that need destructors get them when the arena goes
+  auto owned{std::make_shared<int>(5)};
+  arena->make<std::shared_ptr<int>>(owned);
+  std::weak_ptr<int> weak_owned{owned};
+  owned.reset();
+
+  // Retained arenas live as long as the arena holding them
+  std::weak_ptr<AstArena> weak{arena};
+  auto other{std::make_shared<AstArena>()};
+  other->retain(arena);
+  arena.reset();
+  if (weak.expired()) {
+    std::cout << "retained arena was freed" << std::endl;
+    return false;
+  }
+  other.reset();
+  if (!weak.expired() || !weak_owned.expired()) {
+    std::cout << "arena outlived its owners" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool test_ast_image() {
+  std::string source{R"(
+    let add = fn(a, b) { return a + b; };
+    let big = -9223372036854775807;
+    let h = {"one": [1, 2][0], true: !false};
+    if (add(1, 2) > 2) { h["one"] } else { "no" };
+    fn() {}();
+  )"};
+  Parser parser{Lexer{source}};
+  auto program{parser.parse_program()};
+  auto path{(std::filesystem::temp_directory_path() / "monke_test.ast")};
+  if (!ast_image::write(*program, source, path)) {
+    std::cout << "could not write image" << std::endl;
+    return false;
+  }
+
+  auto loaded{ast_image::load(path, source)};
+  if (!loaded || loaded->to_string() != program->to_string()) {
+    std::cout << "image round trip failed. got: "
+              << (loaded ? loaded->to_string() : "nullptr") << std::endl;
+    return false;
+  }
+
+  if (ast_image::load(path, source + " ")) {
+    std::cout << "stale image was loaded" << std::endl;
+    return false;
+  }
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+  if (ast_image::load(path, source)) {
+    std::cout << "truncated image was loaded" << std::endl;
+    return false;
+  }
+
+  // Nesting is only limited by memory, in both directions
+  const size_t depth{1'000'000};
+  auto deep{std::string(depth, '[') + "1" + std::string(depth, ']')};
+  Parser deep_parser{Lexer{deep}};
+  deep_parser.explicit_stack = true;
+  program = deep_parser.parse_program();
+  if (!ast_image::write(*program, deep, path) ||
+      !(loaded = ast_image::load(path, deep))) {
+    std::cout << "deep image round trip failed" << std::endl;
+    return false;
+  }
+  auto *node{static_cast<ExpressionStatement *>(loaded->statements[0])->value};
+  size_t levels{0};
+  for (; node->kind == NodeKind::ArrayLiteral; ++levels) {
+    node = static_cast<ArrayLiteral *>(node)->elements[0];
+  }
+  if (levels != depth) {
+    std::cout << "deep image has " << levels << " levels" << std::endl;
+    return false;
+  }
+  std::filesystem::remove(path);
+  return true;
+}
+
+// Collects the kind each node should have from its dynamic type
+void h_expected_kinds(Node *n, std::vector<std::pair<Node *, NodeKind>> &out) {
+  auto add{[&out](Node *node, NodeKind kind) {
+    out.emplace_back(node, kind);
+  }};
+  if (auto *p{dynamic_cast<Program *>(n)}) {
+    add(n, NodeKind::Program);
+    for (auto *s : p->statements) {
+      h_expected_kinds(s, out);
+    }
+  } else if (dynamic_cast<Identifier *>(n)) {
+    add(n, NodeKind::Identifier);
+  } else if (dynamic_cast<BooleanLiteral *>(n)) {
+    add(n, NodeKind::BooleanLiteral);
+  } else if (dynamic_cast<IntegerLiteral *>(n)) {
+    add(n, NodeKind::IntegerLiteral);
+  } else if (dynamic_cast<StringLiteral *>(n)) {
+    add(n, NodeKind::StringLiteral);
+  } else if (auto *e{dynamic_cast<ArrayLiteral *>(n)}) {
+    add(n, NodeKind::ArrayLiteral);
+    for (auto *element : e->elements) {
+      h_expected_kinds(element, out);
+    }
+  } else if (auto *e{dynamic_cast<HashLiteral *>(n)}) {
+    add(n, NodeKind::HashLiteral);
+    for (auto [key, value] : e->pairs) {
+      h_expected_kinds(key, out);
+      h_expected_kinds(value, out);
+    }
+  } else if (auto *e{dynamic_cast<PrefixExpression *>(n)}) {
+    add(n, NodeKind::PrefixExpression);
+    h_expected_kinds(e->right, out);
+  } else if (auto *e{dynamic_cast<IndexExpression *>(n)}) {
+    add(n, NodeKind::IndexExpression);
+    h_expected_kinds(e->left, out);
+    h_expected_kinds(e->index, out);
+  } else if (auto *e{dynamic_cast<InfixExpression *>(n)}) {
+    add(n, NodeKind::InfixExpression);
+    h_expected_kinds(e->left, out);
+    h_expected_kinds(e->right, out);
+  } else if (auto *e{dynamic_cast<CallExpression *>(n)}) {
+    add(n, NodeKind::CallExpression);
+    h_expected_kinds(e->function, out);
+    for (auto *argument : e->arguments) {
+      h_expected_kinds(argument, out);
+    }
+  } else if (auto *e{dynamic_cast<IfExpression *>(n)}) {
+    add(n, NodeKind::IfExpression);
+    h_expected_kinds(e->condition, out);
+    h_expected_kinds(e->consequence, out);
+  } else if (auto *e{dynamic_cast<FunctionLiteral *>(n)}) {
+    add(n, NodeKind::FunctionLiteral);
+    h_expected_kinds(e->body(), out);
+  } else if (auto *s{dynamic_cast<LetStatement *>(n)}) {
+    add(n, NodeKind::LetStatement);
+    h_expected_kinds(s->value, out);
+  } else if (auto *s{dynamic_cast<ReturnStatement *>(n)}) {
+    add(n, NodeKind::ReturnStatement);
+    h_expected_kinds(s->value, out);
+  } else if (auto *s{dynamic_cast<ExpressionStatement *>(n)}) {
+    add(n, NodeKind::ExpressionStatement);
+    h_expected_kinds(s->value, out);
+  } else if (auto *s{dynamic_cast<BlockStatement *>(n)}) {
+    add(n, NodeKind::BlockStatement);
+    for (auto *statement : s->statements) {
+      h_expected_kinds(statement, out);
+    }
+  }
+}
+
+bool test_node_kinds() {
+  Parser parser{Lexer{R"(
+let a = fn(x) { if (!x) { return [1, "s", {true: x[0]}]; } };
+a(1 + 2);
+)"}};
+  auto program{parser.parse_program()};
+  std::vector<std::pair<Node *, NodeKind>> nodes{};
+  h_expected_kinds(program.get(), nodes);
+  // The program has one of each
+  std::vector<bool> seen(static_cast<size_t>(NodeKind::BlockStatement) + 1);
+  for (auto [node, kind] : nodes) {
+    if (node->kind != kind) {
+      std::cout << "wrong kind for " << node->to_string() << std::endl;
+      return false;
+    }
+    seen[static_cast<size_t>(kind)] = true;
+  }
+  if (std::find(seen.begin(), seen.end(), false) != seen.end()) {
+    std::cout << "not every node kind was checked" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
@@ -1,14 +1,32 @@
 #include "lexer/lexer.hpp"
+#include "lexer/stream_lexer.hpp"
 
 #include "test.hpp"
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <vector>
 
 bool test_next_token();
+bool test_borrowed_input();
+bool test_long_runs();
+bool test_keywords();
+bool test_stream_lexer();
+bool test_identifier_interning();
+bool test_tokenize_all();
+bool test_tokenize_parallel();
 
 int main() {
   bool pass{true};
   TEST(test_next_token, pass);
+  TEST(test_borrowed_input, pass);
+  TEST(test_long_runs, pass);
+  TEST(test_keywords, pass);
+  TEST(test_stream_lexer, pass);
+  TEST(test_identifier_interning, pass);
+  TEST(test_tokenize_all, pass);
+  TEST(test_tokenize_parallel, pass);
   return pass ? 0 : 1;
 }
 
@@ -158,3 +176,259 @@ if (5 < 10) {
 
   return true;
 }
+
+bool test_borrowed_input() {
+  std::string_view input{"let foobar = \"foo bar\"; 9223372036854775807 "
+                         "9223372036854775808"};
+  auto l{Lexer::borrow(input)};
+  auto in_input{[&input](std::string_view v) {
+    return v.data() >= input.data() &&
+           v.data() + v.size() <= input.data() + input.size();
+  }};
+
+  l.next_token();
+  l.next_token();
+  l.next_token();
+  auto str{l.next_token()};
+  if (!str.is_type<token_types::String>() || !in_input(str.string_value())) {
+    std::cout << "string does not point into input. got: " << str.to_string()
+              << std::endl;
+    return false;
+  }
+  l.next_token();
+
+  std::vector<std::string> tests{
+      "INT(9223372036854775807)",
+      "ILLEGAL",
+      "EOF",
+  };
+  for (std::size_t i = 0, e = tests.size(); i != e; ++i) {
+    auto got{l.next_token().to_string()};
+    if (got != tests[i]) {
+      std::cout << "Failed test " << i + 1 << ". got: " << got
+                << ". want: " << tests[i] << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Run lengths around the 16 and 32 byte vector widths
+bool test_long_runs() {
+  for (size_t n = 1; n <= 70; ++n) {
+    std::string ident(n, 'a');
+    ident[n - 1] = n % 2 ? 'Z' : '_';
+    std::string space(n, n % 3 ? ' ' : '\n');
+    std::string body(n - 1, 'x');
+    std::string input{space + ident + space + "\"" + body + "\"" + space +
+                      ident + "\""};
+    std::vector<std::string> tests{
+        "IDENT(" + ident + ")",
+        "STRING(" + body + ")",
+        "IDENT(" + ident + ")",
+        "STRING()",
+        "EOF",
+    };
+    auto l{Lexer::borrow(input)};
+    for (std::size_t i = 0, e = tests.size(); i != e; ++i) {
+      auto got{l.next_token().to_string()};
+      if (got != tests[i]) {
+        std::cout << "Failed run length " << n << ". got: " << got
+                  << ". want: " << tests[i] << std::endl;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool test_keywords() {
+  auto input{"fn let true false if else return "
+             "f fnn le lets True fals iff elsE eturn returns _ x"};
+  std::vector<std::string> tests{
+      "FUNCTION",       "LET",         "TRUE",         "FALSE",
+      "IF",             "ELSE",        "RETURN",       "IDENT(f)",
+      "IDENT(fnn)",     "IDENT(le)",   "IDENT(lets)",  "IDENT(True)",
+      "IDENT(fals)",    "IDENT(iff)",  "IDENT(elsE)",  "IDENT(eturn)",
+      "IDENT(returns)", "IDENT(_)",    "IDENT(x)",     "EOF",
+  };
+  Lexer l{input};
+  for (std::size_t i = 0, e = tests.size(); i != e; ++i) {
+    auto got{l.next_token().to_string()};
+    if (got != tests[i]) {
+      std::cout << "Failed test " << i + 1 << ". got: " << got
+                << ". want: " << tests[i] << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Every chunk size splits some token across a refill. The previous token has
+// to survive lexing the next one, like the parser's current token does.
+bool test_stream_lexer() {
+  std::string input{R"(let add = fn(first, second) { first + second; };
+if (add(10, 200) != 210) { "a long string body" } else { x == y; }
+{"key": [1, 22, 333]}; __under_score__ <= !)"};
+  std::vector<std::string> tests{};
+  Lexer l{input};
+  for (auto tok{l.next_token()}; !tok.is_type<token_types::Eof>();
+       tok = l.next_token()) {
+    tests.push_back(tok.to_string());
+  }
+  tests.push_back("EOF");
+
+  for (size_t chunk = 1; chunk <= 24; ++chunk) {
+    std::istringstream in{input};
+    StreamLexer sl{in, chunk};
+    Token prev{};
+    for (std::size_t i = 0, e = tests.size(); i != e; ++i) {
+      auto tok{sl.next_token()};
+      auto got{tok.to_string()};
+      if (got != tests[i] || (i > 0 && prev.to_string() != tests[i - 1])) {
+        std::cout << "Failed chunk size " << chunk << " test " << i + 1
+                  << ". got: " << got << ". want: " << tests[i] << std::endl;
+        return false;
+      }
+      prev = tok;
+    }
+  }
+
+  // Identifiers cut by a refill are interned whole only: their prefixes are
+  // still new to the symbol table afterwards
+  std::string name{"streamed_identifier_probe"};
+  std::istringstream in{name + " + 1"};
+  StreamLexer sl{in, 4};
+  auto symbol{sl.next_token().symbol()};
+  for (size_t length = 1; length < name.length(); ++length) {
+    if (intern(name.substr(0, length)) < symbol) {
+      std::cout << "interned a partial identifier: " << name.substr(0, length)
+                << std::endl;
+      return false;
+    }
+  }
+
+  // Long tokens are read in growing chunks and scanned once
+  std::string word(4 << 20, 'w');
+  std::string text(4 << 20, 't');
+  std::istringstream long_in{word + " \"" + text + "\" 1"};
+  StreamLexer long_sl{long_in, 16};
+  auto long_word{long_sl.next_token()};
+  auto long_text{long_sl.next_token()};
+  if (symbol_name(long_word.symbol()) != word ||
+      long_text.string_value() != text ||
+      long_sl.next_token().to_string() != "INT(1)") {
+    std::cout << "long streamed tokens differ" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool test_identifier_interning() {
+  Lexer l{"foo bar foo"};
+  auto foo{l.next_token().symbol()};
+  auto bar{l.next_token().symbol()};
+  auto foo_again{l.next_token().symbol()};
+  if (foo != foo_again || foo == bar) {
+    std::cout << "wrong symbols. foo: " << foo << ", bar: " << bar
+              << ", foo again: " << foo_again << std::endl;
+    return false;
+  }
+  if (symbol_name(foo) != "foo" || symbol_name(bar) != "bar") {
+    std::cout << "wrong names. got: " << symbol_name(foo) << ", "
+              << symbol_name(bar) << std::endl;
+    return false;
+  }
+  if (intern("foo") != foo) {
+    std::cout << "intern(\"foo\") is not the lexed symbol" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool test_tokenize_all() {
+  std::string input{"let x = 12;\n  \"hi there\" != foo(x)"};
+  std::vector<std::string> tests{
+      "LET",        "IDENT(x)", "ASSIGN",           "INT(12)",
+      "SEMICOLON",  "STRING(hi there)", "NOT_EQ",   "IDENT(foo)",
+      "LPAREN",     "IDENT(x)", "RPAREN",           "EOF",
+  };
+  std::vector<std::string> texts{
+      "let", "x", "=", "12", ";", "\"hi there\"",
+      "!=",  "foo", "(", "x", ")", "",
+  };
+  auto buffer{Lexer{input}.tokenize_all()};
+  if (buffer.size() != tests.size()) {
+    std::cout << "wrong number of tokens. got: " << buffer.size()
+              << ". want: " << tests.size() << std::endl;
+    return false;
+  }
+  for (std::size_t i = 0, e = tests.size(); i != e; ++i) {
+    auto got{buffer.token(i).to_string()};
+    auto text{input.substr(buffer.offsets[i], buffer.lengths[i])};
+    if (got != tests[i] || text != texts[i]) {
+      std::cout << "Failed test " << i + 1 << ". got: " << got << " \""
+                << text << "\". want: " << tests[i] << " \"" << texts[i]
+                << "\"" << std::endl;
+      return false;
+    }
+  }
+
+  // Offsets can't address a larger source, so it isn't lexed. The file is
+  // sparse and never read.
+  auto path{std::filesystem::temp_directory_path() / "monkey_huge_source"};
+  std::ofstream{path};
+  std::filesystem::resize_file(path, TokenBuffer::MAX_SOURCE_SIZE + 2);
+  auto huge{Source::map_file(path)};
+  std::filesystem::remove(path);
+  if (!huge) {
+    std::cout << "could not map a huge source" << std::endl;
+    return false;
+  }
+  for (auto tokens : {Lexer{huge}.tokenize_all(),
+                      Lexer{huge}.tokenize_parallel(4)}) {
+    if (tokens.size() != 2 || tokens.token(0).to_string() != "ILLEGAL") {
+      std::cout << "lexed a source over 4GiB" << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Strings full of whitespace are where a naive split would cut a token
+bool test_tokenize_parallel() {
+  std::string input{};
+  for (int i = 0; i < 200; ++i) {
+    input += "let v" + std::string(i % 7 + 1, 'x') + " = [" +
+             std::to_string(i) + ", \"a string  with\tspaces " +
+             std::to_string(i) + "\"];\n";
+  }
+  auto want{Lexer{input}.tokenize_all()};
+  for (unsigned threads = 2; threads <= 9; ++threads) {
+    auto got{Lexer{input}.tokenize_parallel(threads, 1)};
+    if (got.size() != want.size()) {
+      std::cout << "wrong number of tokens with " << threads
+                << " threads. got: " << got.size() << ". want: " << want.size()
+                << std::endl;
+      return false;
+    }
+    for (size_t i = 0; i < want.size(); ++i) {
+      if (got.token(i).to_string() != want.token(i).to_string() ||
+          got.offsets[i] != want.offsets[i] ||
+          got.lengths[i] != want.lengths[i]) {
+        std::cout << "Failed token " << i << " with " << threads
+                  << " threads. got: " << got.token(i).to_string()
+                  << ". want: " << want.token(i).to_string() << std::endl;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
@@ -3,10 +3,12 @@
 #include "object/object.hpp"
 
 bool test_string_hash_key();
+bool test_release_deep_values();
 
 int main() {
   bool pass{true};
   TEST(test_string_hash_key, pass);
+  TEST(test_release_deep_values, pass);
   return pass ? 0 : 1;
 }
 
@@ -30,3 +32,28 @@ bool test_string_hash_key() {
 
   return true;
 };
+
+bool test_release_deep_values() {
+  auto shared{std::make_shared<String>("kept")};
+  std::shared_ptr<Object> value{
+      std::make_shared<Array>(std::vector<std::shared_ptr<Object>>{shared})};
+  std::weak_ptr<Object> innermost{value};
+  for (int i = 0; i < 1'000'000; ++i) {
+    if (i % 2) {
+      value = std::make_shared<Array>(std::vector<std::shared_ptr<Object>>{
+          value, std::make_shared<Integer>(i)});
+    } else {
+      auto key{std::make_shared<Integer>(i)};
+      value = std::make_shared<Hash>(std::unordered_map<HashKey, HashPair>{
+          {key->hash_key(), HashPair{key, value}}});
+    }
+  }
+  // Would overflow the stack if destructors recursed
+  value.reset();
+  if (!innermost.expired() || shared->value != "kept") {
+    std::cout << "deep value not released properly" << std::endl;
+    return false;
+  }
+
+  return true;
+}
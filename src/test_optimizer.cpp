@@ -0,0 +1,453 @@
+#include "test.hpp"
+
+#include "ast/ast.hpp"
+#include "evaluator/evaluator.hpp"
+#include "object/object.hpp"
+#include "optimizer/optimizer.hpp"
+#include "optimizer/resolver.hpp"
+#include "parser/parser.hpp"
+#include <algorithm>
+
+bool test_fold_constants();
+bool test_folding_preserves_results();
+bool test_fold_lazy_function_bodies();
+bool test_resolve_addresses();
+bool test_resolved_scoping();
+bool test_closure_conversion();
+bool test_deep_nesting();
+
+int main() {
+  bool pass{true};
+  TEST(test_fold_constants, pass);
+  TEST(test_folding_preserves_results, pass);
+  TEST(test_fold_lazy_function_bodies, pass);
+  TEST(test_resolve_addresses, pass);
+  TEST(test_resolved_scoping, pass);
+  TEST(test_closure_conversion, pass);
+  TEST(test_deep_nesting, pass);
+  return pass ? 0 : 1;
+}
+
+std::string h_folded(std::string input) {
+  Parser p{Lexer{input}};
+  auto program{p.parse_program()};
+  fold_constants(*program);
+  return program->to_string();
+}
+
+std::string h_eval(std::string input, bool optimize) {
+  Parser p{Lexer{input}};
+  auto program{p.parse_program()};
+  if (optimize) {
+    fold_constants(*program);
+    resolve(*program);
+  }
+  auto evaluated{eval(program.get(), std::make_shared<Environment>())};
+  return evaluated ? evaluated->inspect() : "nullptr";
+}
+
+bool test_fold_constants() {
+  struct {
+    std::string input;
+    std::string expected;
+  } tests[]{
+      {"1 + 2 * 3", "7"},
+      {"10 / 3 - 4", "-1"},
+      {"-5", "-5"},
+      {"--5", "5"},
+      {"1 < 2", "true"},
+      {"1 == 2", "false"},
+      {"true != false", "true"},
+      {"!true", "false"},
+      {"!5", "false"},
+      {"!!\"\"", "true"},
+      {"\"foo\" + \"bar\"", "foobar"},
+      {"x + (2 * 3)", "(x + 6)"},
+      {"[1 + 1, {2 * 2: 3 - 3}]", "[2, {4: 0}]"},
+      {"f(1 + 1)[0 + 0]", "(f(2)[0])"},
+      {"if (1 < 2) { 10 } else { 20 }", "10"},
+      {"if (false) { 10 } else { 2 * 10 }", "20"},
+      {"if (true) { let a = 1; a }", "if (true) {\nlet a = 1;\na\n\n}"},
+      {"if (x) { 1 + 1 } else { 2 + 2 }", "if (x) {\n2\n\n} else {\n4\n\n}"},
+      {"let f = fn(x) { x * (1 + 2) }", "let f = fn(x) {\n(x * 3)\n};"},
+      // Left for the evaluator
+      {"if (false) { 10 }", "if (false) {\n10\n\n}"},
+      {"1 + true", "(1 + true)"},
+      {"true + false", "(true + false)"},
+      {"true < false", "(true < false)"},
+      {"\"a\" - \"b\"", "(a - b)"},
+      {"-true", "(-true)"},
+      {"5 / 0", "(5 / 0)"},
+      {"9223372036854775807 + 1", "(9223372036854775807 + 1)"},
+      {"4611686018427387904 * 2", "(4611686018427387904 * 2)"},
+  };
+
+  bool pass{true};
+  for (const auto &test : tests) {
+    auto got{h_folded(test.input)};
+    if (got != test.expected) {
+      std::cout << "Failed test. " << test.input << ": got " << got
+                << ", want " << test.expected << std::endl;
+      pass = false;
+    }
+  }
+  return pass;
+}
+
+bool test_folding_preserves_results() {
+  std::string tests[]{
+      "1 + 2 * 3 - 4 / 2",
+      "-(5 + 5) * 2",
+      "(1 < 2) == true",
+      "!(1 > 2) != false",
+      "\"Hello\" + \" \" + \"World!\"",
+      "if (1 > 2) { 10 }",
+      "if (0) { 10 } else { 20 }",
+      "if (true) { return 1 + 1; 99 }",
+      "let x = 5; if (x > 1) { x * (2 + 3) }",
+      "let f = fn(a) { if (1 < 2) { a + 1 } }; f(4)",
+      "len(\"ab\" + \"cd\")",
+      "[1 + 1, 2 * 2][3 - 2]",
+      "{\"a\" + \"b\": 1 + 1}[\"ab\"]",
+      "5 + true",
+      "true + false",
+      "-true",
+      "\"a\" - \"b\"",
+      "if (10 > 1) { true + false; }",
+  };
+
+  bool pass{true};
+  for (const auto &input : tests) {
+    auto want{h_eval(input, false)};
+    auto got{h_eval(input, true)};
+    if (got != want) {
+      std::cout << "Failed test. " << input << ": got " << got << ", want "
+                << want << std::endl;
+      pass = false;
+    }
+  }
+  return pass;
+}
+
+bool test_fold_lazy_function_bodies() {
+  auto tokens{std::make_shared<TokenBuffer>(
+      Lexer{"let f = fn() { 2 * 3 }; f()"}.tokenize_all())};
+  Parser p{tokens};
+  p.lazy_functions = true;
+  auto program{p.parse_program()};
+  fold_constants(*program);
+  auto *let{static_cast<LetStatement *>(program->statements[0])};
+  auto *literal{static_cast<FunctionLiteral *>(let->value)};
+  if (literal->body_parsed()) {
+    std::cout << "folding parsed a lazy function body" << std::endl;
+    return false;
+  }
+
+  auto evaluated{eval(program.get(), std::make_shared<Environment>())};
+  if (!evaluated || evaluated->inspect() != "6") {
+    std::cout << "lazy function returned "
+              << (evaluated ? evaluated->inspect() : "nullptr") << std::endl;
+    return false;
+  }
+  if (!literal->body_parsed() || literal->body()->to_string() != "6\n") {
+    std::cout << "lazy body wasn't folded when parsed: "
+              << literal->body()->to_string() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool test_resolve_addresses() {
+  Parser p{Lexer{"let g = 1; let f = fn(a, b) { let c = a; fn(d) { let a = "
+                 "d; [a, b, c, g, len, fn() { d }] } }"}};
+  auto program{p.parse_program()};
+  resolve(*program);
+  auto *global{static_cast<LetStatement *>(program->statements[0])};
+  auto *outer{static_cast<FunctionLiteral *>(
+      static_cast<LetStatement *>(program->statements[1])->value)};
+  auto *outer_let{static_cast<LetStatement *>(outer->body()->statements[0])};
+  auto *inner{static_cast<FunctionLiteral *>(
+      static_cast<ExpressionStatement *>(outer->body()->statements[1])
+          ->value)};
+  auto *inner_let{static_cast<LetStatement *>(inner->body()->statements[0])};
+  auto *array{static_cast<ArrayLiteral *>(
+      static_cast<ExpressionStatement *>(inner->body()->statements[1])
+          ->value)};
+  auto *innermost{static_cast<FunctionLiteral *>(array->elements[5])};
+
+  using enum Identifier::Binding;
+  bool pass{true};
+  auto check{[&pass](std::string what, const Identifier &ident,
+                     Identifier::Binding binding, uint32_t slot) {
+    if (ident.binding != binding ||
+        (binding != Global && ident.slot != slot)) {
+      std::cout << what << " resolved to (" << static_cast<int>(ident.binding)
+                << ", " << ident.slot << "), want ("
+                << static_cast<int>(binding) << ", " << slot << ")"
+                << std::endl;
+      pass = false;
+    }
+  }};
+  check("global let", global->identifier, Global, 0);
+  check("param a", outer->params[0], Local, 0);
+  check("param b", outer->params[1], Cell, 1);
+  check("let c", outer_let->identifier, Cell, 2);
+  check("c's value", *static_cast<Identifier *>(outer_let->value), Local, 0);
+  check("inner param d", inner->params[0], Cell, 0);
+  check("inner let a", inner_let->identifier, Local, 1);
+  const std::pair<Identifier::Binding, uint32_t> want[]{
+      {Local, 1}, {Capture, 0}, {Capture, 1}, {Global, 0}, {Global, 0}};
+  for (size_t i = 0; i < std::size(want); i++) {
+    check(array->elements[i]->to_string(),
+          *static_cast<Identifier *>(array->elements[i]), want[i].first,
+          want[i].second);
+  }
+  auto *d{static_cast<ExpressionStatement *>(innermost->body()->statements[0])
+              ->value};
+  check("innermost d", *static_cast<Identifier *>(d), Capture, 0);
+
+  auto same{[](std::span<const ::Capture> got,
+               std::vector<std::pair<bool, uint32_t>> want) {
+    return got.size() == want.size() &&
+           std::equal(got.begin(), got.end(), want.begin(),
+                      [](::Capture c, std::pair<bool, uint32_t> w) {
+                        return c.cell == w.first && c.index == w.second;
+                      });
+  }};
+  if (outer->locals.size() != 3 || outer->cells.size() != 2 ||
+      !outer->captures.empty() || inner->locals.size() != 2 ||
+      inner->cells.size() != 1 || !same(inner->captures, {{1, 1}, {1, 2}}) ||
+      !same(innermost->captures, {{1, 0}})) {
+    std::cout << "wrong function layouts" << std::endl;
+    pass = false;
+  }
+
+  // Captures are passed down through functions that don't use them
+  Parser q{Lexer{"fn(x) { fn() { fn() { x } } }"}};
+  auto nested{q.parse_program()};
+  resolve(*nested);
+  auto *f{static_cast<FunctionLiteral *>(
+      static_cast<ExpressionStatement *>(nested->statements[0])->value)};
+  auto *g{static_cast<FunctionLiteral *>(
+      static_cast<ExpressionStatement *>(f->body()->statements[0])->value)};
+  auto *h{static_cast<FunctionLiteral *>(
+      static_cast<ExpressionStatement *>(g->body()->statements[0])->value)};
+  if (!same(g->captures, {{1, 0}}) || !same(h->captures, {{0, 0}})) {
+    std::cout << "captures weren't passed down" << std::endl;
+    pass = false;
+  }
+  return pass;
+}
+
+bool test_resolved_scoping() {
+  std::string tests[]{
+      "let x = 1; let f = fn() { let y = x; let x = 2; [x, y] }; f()",
+      "let x = 1; let f = fn() { if (false) { let x = 2; } x }; f()",
+      "let x = 1; let f = fn() { if (true) { let x = 2; } x }; f()",
+      "let f = fn() { let g = fn() { h() }; let h = fn() { 5 }; g() }; f()",
+      "let adder = fn(a) { fn(b) { a + b } }; adder(2)(3)",
+      "let f = fn(a, a) { a }; f(1, 2)",
+      "let f = fn(a, b) { b }; f(1)",
+      "let f = fn(a) { a }; f(1, 2)",
+      "let f = fn() { g }; let g = 3; f()",
+      "let fib = fn(n) { if (n < 2) { return n; } fib(n - 1) + fib(n - 2) }; "
+      "fib(15)",
+      "let f = fn() { let len = fn(x) { 42 }; len(\"abc\") }; [f(), "
+      "len(\"abc\")]",
+      "let f = fn() { missing }; f()",
+      "let f = fn() { let g = fn() { x }; let x = 5; g() }; f()",
+      "let f = fn(a) { fn(b) { fn(c) { a + b + c } } }; f(1)(2)(3)",
+      "let f = fn(n) { let r = fn(k) { if (k == 0) { n } else { r(k - 1) } }; "
+      "r(3) }; f(7)",
+  };
+
+  bool pass{true};
+  for (const auto &input : tests) {
+    auto want{h_eval(input, false)};
+    auto got{h_eval(input, true)};
+    if (got != want) {
+      std::cout << "Failed test. " << input << ": got " << got << ", want "
+                << want << std::endl;
+      pass = false;
+    }
+  }
+
+  // Until a let runs, its name means the enclosing function's variable
+  struct {
+    std::string input;
+    std::string expected;
+  } shadowing[]{
+      {"let f = fn() { let x = 5; fn() { if (false) { let x = 1 }; x }() }; "
+       "f()",
+       "5"},
+      {"let f = fn() { let x = 5; fn() { let y = x; let x = 1; [y, x] }() }; "
+       "f()",
+       "[5, 1]"},
+      {"let f = fn() { let x = 5; fn() { if (false) { let x = 1 }; fn() { if "
+       "(false) { let x = 2 }; x }() }() }; f()",
+       "5"},
+      {"let f = fn() { let x = 5; fn() { let g = fn() { x }; let y = g(); let "
+       "x = 1; [y, g()] }() }; f()",
+       "[5, 1]"},
+      {"let x = 7; let f = fn() { fn() { if (false) { let x = 1 }; x }() }; "
+       "f()",
+       "7"},
+  };
+  for (const auto &[input, expected] : shadowing) {
+    auto got{h_eval(input, true)};
+    if (got != expected) {
+      std::cout << "Failed test. " << input << ": got " << got << ", want "
+                << expected << std::endl;
+      pass = false;
+    }
+  }
+
+  // Globals can come from later programs
+  auto env{std::make_shared<Environment>()};
+  std::vector<std::shared_ptr<Program>> programs{};
+  std::string got{};
+  for (std::string input :
+       {"let f = fn(x) { x + y }", "let y = 10", "f(5)"}) {
+    Parser p{Lexer{input}};
+    programs.push_back(p.parse_program());
+    resolve(*programs.back());
+    got = eval(programs.back().get(), env)->inspect();
+  }
+  if (got != "15") {
+    std::cout << "Failed test. global defined later: got " << got << std::endl;
+    pass = false;
+  }
+
+  // Lazy bodies are resolved in the scopes they were nested in
+  auto tokens{std::make_shared<TokenBuffer>(
+      Lexer{"let f = fn(a) { fn(b) { a * b } }; f(6)(7)"}.tokenize_all())};
+  Parser p{tokens};
+  p.lazy_functions = true;
+  auto program{p.parse_program()};
+  resolve(*program);
+  auto evaluated{eval(program.get(), std::make_shared<Environment>())};
+  if (!evaluated || evaluated->inspect() != "42") {
+    std::cout << "Failed test. lazy closure: got "
+              << (evaluated ? evaluated->inspect() : "nullptr") << std::endl;
+    pass = false;
+  }
+  return pass;
+}
+
+bool test_closure_conversion() {
+  auto env{std::make_shared<Environment>()};
+  std::weak_ptr<Object> weak{};
+  {
+    Parser p{Lexer{"let f = fn() { let big = [1, 2, 3]; let small = 1; fn() "
+                   "{ small } }; let g = f(); g()"}};
+    auto program{p.parse_program()};
+    resolve(*program);
+    auto evaluated{eval(program.get(), env)};
+    if (!evaluated || evaluated->inspect() != "1") {
+      std::cout << "closure returned "
+                << (evaluated ? evaluated->inspect() : "nullptr") << std::endl;
+      return false;
+    }
+    auto g{std::static_pointer_cast<Function>(env->get(intern("g")))};
+    if (g->captures.size() != 1) {
+      std::cout << "closure captured " << g->captures.size()
+                << " variables, want 1" << std::endl;
+      return false;
+    }
+    weak = env->get(intern("f"));
+  }
+  // Functions don't hold the globals they are bound in
+  env.reset();
+  if (!weak.expired()) {
+    std::cout << "function bound to a global leaked" << std::endl;
+    return false;
+  }
+  // Local functions named by a let reach themselves without capturing their
+  // own cell, directly or from closures inside them. Rebinding the name
+  // turns that off.
+  struct {
+    const char *input;
+    const char *expected;
+  } tests[]{
+      {"let f = fn() { let iter = fn(n, acc) { if (n == 0) { acc } else { "
+       "iter(n - 1, acc + n) } }; iter }; let g = f(); g(4, 0)",
+       "10"},
+      {"let f = fn() { let iter = fn(n) { if (n == 0) { 0 } else { fn() { "
+       "iter(n - 1) }() } }; iter }; let g = f(); g(3)",
+       "0"},
+      {"let f = fn() { let iter = fn() { iter }; let iter = 2; iter }; "
+       "let g = f(); g",
+       "2"},
+  };
+  for (auto [input, expected] : tests) {
+    env = std::make_shared<Environment>();
+    {
+      Parser p{Lexer{input}};
+      auto program{p.parse_program()};
+      resolve(*program);
+      auto evaluated{eval(program.get(), env)};
+      if (!evaluated || evaluated->inspect() != expected) {
+        std::cout << input << " returned "
+                  << (evaluated ? evaluated->inspect() : "nullptr")
+                  << std::endl;
+        return false;
+      }
+      weak = env->get(intern("g"));
+    }
+    env.reset();
+    if (!weak.expired()) {
+      std::cout << "recursive local function leaked: " << input << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// The passes keep up with what the explicit-stack parser and evaluator handle
+bool test_deep_nesting() {
+  const size_t depth{1'000'000};
+  std::string sum{};
+  std::string constant_sum{};
+  for (size_t i = 1; i < depth; ++i) {
+    sum += "x + ";
+    constant_sum += "1 + ";
+  }
+  // Function literals still parse their bodies on the native stack
+  std::string nested{};
+  std::string calls{};
+  for (size_t i = 0; i < depth / 100; ++i) {
+    nested += "fn() { ";
+    calls += " }()";
+  }
+  struct {
+    std::string input;
+    std::string expected;
+  } tests[]{
+      {"let a = " + std::string(depth, '[') + "1" + std::string(depth, ']') +
+           "; len(a)",
+       "1"},
+      {"let x = 1; " + sum + "x", std::to_string(depth)},
+      {"let x = 5; " + std::string(depth, '-') + "x", "5"},
+      {constant_sum + "1", std::to_string(depth)},
+      // Each level captures x from the one outside
+      {"let f = fn(x) { " + nested + "x" + calls + " }; f(7)", "7"},
+  };
+
+  bool pass{true};
+  for (const auto &[input, expected] : tests) {
+    Parser p{Lexer{input}};
+    p.explicit_stack = true;
+    auto program{p.parse_program()};
+    fold_constants(*program);
+    resolve(*program);
+    auto evaluated{
+        eval_explicit_stack(program.get(), std::make_shared<Environment>())};
+    auto got{evaluated ? evaluated->inspect() : "nullptr"};
+    if (got != expected) {
+      std::cout << "Failed test. " << input.substr(0, 20) << "...: got " << got
+                << ", want " << expected << std::endl;
+      pass = false;
+    }
+  }
+  return pass;
+}
@@ -1,8 +1,10 @@
 #include "test.hpp"
 
+#include "parser/incremental_parser.hpp"
 #include "parser/parser.hpp"
 #include <any>
 #include <iostream>
+#include <unordered_map>
 
 bool test_let_statements();
 bool test_return_statements();
@@ -31,6 +33,13 @@ bool test_hash_literal_parsing_string_keys();
 bool test_hash_literal_parsing_empty();
 bool test_hash_literal_parsing_with_expressions();
 
+bool test_parse_token_buffer();
+bool test_incremental_parsing();
+bool test_parse_program_parallel();
+bool test_explicit_stack_parsing();
+bool test_explicit_stack_deep_nesting();
+bool test_lazy_function_parsing();
+
 int main() {
   bool pass{true};
   TEST(test_let_statements, pass);
@@ -54,6 +63,12 @@ int main() {
   TEST(test_hash_literal_parsing_string_keys, pass);
   TEST(test_hash_literal_parsing_empty, pass);
   TEST(test_hash_literal_parsing_with_expressions, pass);
+  TEST(test_parse_token_buffer, pass);
+  TEST(test_incremental_parsing, pass);
+  TEST(test_parse_program_parallel, pass);
+  TEST(test_explicit_stack_parsing, pass);
+  TEST(test_explicit_stack_deep_nesting, pass);
+  TEST(test_lazy_function_parsing, pass);
   return pass ? 0 : 1;
 }
 
@@ -68,9 +83,8 @@ std::shared_ptr<Program> h_parser_pre_checks(Parser &p,
 Parser h_parse_input(std::string input);
 
 template <class StatementType>
-bool h_assert_type(std::shared_ptr<Statement> to_convert,
-                   std::shared_ptr<Statement> &var) {
-  var = std::shared_ptr<StatementType>(to_convert);
+bool h_assert_type(Statement *to_convert, Statement *&var) {
+  var = dynamic_cast<StatementType *>(to_convert);
   if (!var) {
     std::cout << "Failed test: not a " << typeid(StatementType).name()
               << std::endl;
@@ -79,15 +93,15 @@ bool h_assert_type(std::shared_ptr<Statement> to_convert,
   return true;
 }
 
-template <typename To> using ExprSubtype = std::shared_ptr<To>;
+// Nodes are owned by the Program's arena
+template <typename To> using ExprSubtype = To *;
 
-template <typename To> using StatementSubtype = std::shared_ptr<To>;
+template <typename To> using StatementSubtype = To *;
 
 template <typename To>
 StatementSubtype<To>
-h_assert_statement_type(std::shared_ptr<Statement> test_statement,
-                        bool &result) {
-  auto statement{std::dynamic_pointer_cast<To>(std::move(test_statement))};
+h_assert_statement_type(Statement *test_statement, bool &result) {
+  auto statement{dynamic_cast<To *>(test_statement)};
   if (!statement) {
     std::cout << "Failed test: not " << typeid(To).name() << std::endl;
     result = false;
@@ -97,9 +111,8 @@ h_assert_statement_type(std::shared_ptr<Statement> test_statement,
 }
 
 template <typename To>
-ExprSubtype<To> h_assert_expr_type(std::shared_ptr<Expression> test_expr,
-                                   bool &result) {
-  auto expr{std::dynamic_pointer_cast<To>(std::move(test_expr))};
+ExprSubtype<To> h_assert_expr_type(Expression *test_expr, bool &result) {
+  auto expr{dynamic_cast<To *>(test_expr)};
   if (!expr) {
     std::cout << "Failed test: not " << typeid(To).name() << std::endl;
     result = false;
@@ -119,7 +132,7 @@ bool h_assert_value(Expr &expr, T test_value) {
 }
 
 template <class Expr, typename T>
-bool h_test_literal_expr(std::shared_ptr<Expression> test_expr, T test_value) {
+bool h_test_literal_expr(Expression *test_expr, T test_value) {
   auto result{true};
   ExprSubtype<Expr> expr{
       h_assert_expr_type<Expr>(std::move(test_expr), result)};
@@ -148,7 +161,7 @@ h_assert_expr_type_statement(StatementSubtype<ExpressionStatement> statement,
 
 template <typename To>
 ExprSubtype<To>
-h_get_single_expression_statement(std::shared_ptr<Statement> gen) {
+h_get_single_expression_statement(Statement *gen) {
   bool result{true};
   auto statement{
       h_assert_statement_type<ExpressionStatement>(std::move(gen), result)};
@@ -162,7 +175,7 @@ h_get_single_expression_statement(std::shared_ptr<Statement> gen) {
 
 template <typename To, typename Value>
 ExprSubtype<To>
-h_get_single_expression_statement(std::shared_ptr<Statement> gen, Value value) {
+h_get_single_expression_statement(Statement *gen, Value value) {
   auto expr{h_get_single_expression_statement<To>(gen)};
   if (!h_assert_value(expr, value)) {
     return nullptr;
@@ -172,8 +185,7 @@ h_get_single_expression_statement(std::shared_ptr<Statement> gen, Value value) {
 }
 
 template <typename To, typename Value>
-bool test_single_expression_statement(std::shared_ptr<Statement> gen,
-                                      Value value) {
+bool test_single_expression_statement(Statement *gen, Value value) {
   return !!h_get_single_expression_statement<To>(gen, value);
 }
 
@@ -185,6 +197,9 @@ ExprSubtype<To> get_single_expression_program(std::string input) {
   if (!program) {
     return nullptr;
   }
+  // The returned node lives in the program's arena
+  static std::shared_ptr<Program> last_program{};
+  last_program = program;
   return h_get_single_expression_statement<To>(
       std::move(program->statements[0]));
 }
@@ -275,7 +290,7 @@ bool h_test_return(std::string input, T value) {
 
 template <typename T> struct prefix_test_case {
   std::string input;
-  token_types::TokenVariant oper;
+  TokenKind oper;
   T value;
 };
 
@@ -300,13 +315,13 @@ bool h_do_prefix_test_case(prefix_test_case<T> test) {
 template <typename T> struct infix_test_case {
   std::string input;
   T left;
-  token_types::TokenVariant oper;
+  TokenKind oper;
   T right;
 };
 
 template <class C, typename T>
 bool h_test_single_infix_expression(ExprSubtype<InfixExpression> expr, T left,
-                                    token_types::TokenVariant oper, T right) {
+                                    TokenKind oper, T right) {
 
   if (expr->oper != oper) {
     std::cout << "Wrong operator. want: " << type_to_string(oper)
@@ -336,7 +351,7 @@ bool h_do_infix_test_case(infix_test_case<T> test) {
 
 template <typename Expr>
 ExprSubtype<Expr>
-h_test_single_block_statement(std::shared_ptr<BlockStatement> block) {
+h_test_single_block_statement(BlockStatement *block) {
   size_t length{block->statements.size()};
   if (length != 1) {
     std::cout << "Incorrect number of statements. got " << length << " want "
@@ -614,8 +629,7 @@ bool test_function_literal_parsing() {
     return false;
   }
 
-  auto body_expr{
-      h_test_single_block_statement<InfixExpression>(std::move(expr->body))};
+  auto body_expr{h_test_single_block_statement<InfixExpression>(expr->body())};
   if (!body_expr) {
     return false;
   }
@@ -816,7 +830,7 @@ bool test_hash_literal_parsing_string_keys() {
     if (!result) {
       return false;
     }
-    auto val{expected[str->value]};
+    auto val{expected[std::string{str->value}]};
     if (!h_test_literal_expr<IntegerLiteral>(k.second, val)) {
       return false;
     }
@@ -856,7 +870,7 @@ bool test_hash_literal_parsing_with_expressions() {
 
   struct infix {
     IntType left;
-    TokenVariant oper;
+    TokenKind oper;
     IntType right;
   };
   std::unordered_map<std::string, infix> expected{
@@ -870,7 +884,7 @@ bool test_hash_literal_parsing_with_expressions() {
     if (!result) {
       return false;
     }
-    auto val{expected[str->value]};
+    auto val{expected[std::string{str->value}]};
     auto infix_expr{h_assert_expr_type<InfixExpression>(k.second, result)};
     if (!h_test_single_infix_expression<IntegerLiteral>(infix_expr, val.left,
                                                         val.oper, val.right)) {
@@ -880,6 +894,241 @@ bool test_hash_literal_parsing_with_expressions() {
 
   return true;
 }
+
+bool test_parse_token_buffer() {
+  std::string input{R"(let add = fn(a, b) { return a + b * -c[1]; };
+if (add(1, 2) > 2) { "yes" } else { [true, {"k": 3}] })"};
+  Parser from_lexer{Lexer{input}};
+  auto want{from_lexer.parse_program()};
+  Parser p{std::make_shared<TokenBuffer>(Lexer{input}.tokenize_all())};
+  auto got{p.parse_program()};
+  bool pass{true};
+  h_check_errors(p, got, pass);
+  if (!pass) {
+    return false;
+  }
+  if (got->to_string() != want->to_string()) {
+    std::cout << "Failed test - want: " << want->to_string()
+              << ". got: " << got->to_string() << std::endl;
+    return false;
+  }
+
+  return true;
+}
+bool test_incremental_parsing() {
+  struct edit_case {
+    std::string anchor; // edit at its first occurrence, or the end if empty
+    size_t removed;
+    std::string inserted;
+    size_t max_reparsed;
+    bool keeps_last;
+  };
+  IncrementalParser doc{"let a = 1;\nlet b = a + 2;\nlet c = fn(x) { x };\n"
+                        "c(b);\nlet d = \"str\";\nd"};
+  auto tests{std::vector<edit_case>{
+      {"2;", 1, "20", 1, true},      // let b = a + 20;
+      {"let a", 0, "a;\n", 2, true}, // new first statement
+      {"", 0, "(1)", 2, false},      // d(1)
+      {"c(b)", 0, "\"", 4, false},   // quote swallows the rest
+      {"\"c(b)", 1, "", 4, false},   // and back
+      {"let b", 16, "", 2, true},    // delete let b
+  }};
+  for (size_t i = 0; i < tests.size(); ++i) {
+    auto &test{tests[i]};
+    auto before{doc.program()};
+    auto offset{test.anchor.empty() ? doc.text().size()
+                                    : doc.text().find(test.anchor)};
+    doc.edit(offset, test.removed, test.inserted);
+    Parser p{Lexer{doc.text()}};
+    auto want{p.parse_program()};
+    auto got{doc.program()};
+    if (got->to_string() != want->to_string() || doc.errors() != p.errors) {
+      std::cout << "Failed edit " << i << " - want: " << want->to_string()
+                << ". got: " << got->to_string() << std::endl;
+      return false;
+    }
+    if (doc.reparsed() > test.max_reparsed) {
+      std::cout << "Failed edit " << i << " - reparsed " << doc.reparsed()
+                << " statements, want at most " << test.max_reparsed
+                << std::endl;
+      return false;
+    }
+    if (test.keeps_last &&
+        got->statements.back() != before->statements.back()) {
+      std::cout << "Failed edit " << i << " - last statement was not reused"
+                << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
 // }}}
 
+bool test_parse_program_parallel() {
+  std::string input{};
+  for (int i = 0; i < 200; ++i) {
+    auto n{std::to_string(i)};
+    auto f{"f_" + std::string(i % 5 + 1, 'a' + i % 26)};
+    input += "let " + f + " = fn(x) { let y = x * " + n + "; y };\n";
+    input += "if (" + f + "(1) > 2) { {\"k\": [1, 2]}; } else { 3 }\n";
+    input += f + "(" + n + ");\n";
+  }
+  for (auto broken : {false, true}) {
+    if (broken) {
+      input += "let = 5; fn(x { x };\n" + input;
+    }
+    auto tokens{std::make_shared<TokenBuffer>(Lexer{input}.tokenize_all())};
+    Parser serial{tokens};
+    auto want{serial.parse_program()};
+    Parser parallel{tokens};
+    auto got{parallel.parse_program_parallel(4, 64)};
+    // Failed parses leave null children that to_string() can't print
+    if (got->statements.size() != want->statements.size() ||
+        (!broken && got->to_string() != want->to_string()) ||
+        parallel.errors != serial.errors || !parallel.at_end()) {
+      std::cout << "parallel parse differs, broken: " << broken << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool test_explicit_stack_parsing() {
+  std::vector<std::pair<std::string, bool>> inputs{
+      {"-a * b + !c / d == e != f < g > h", true},
+      {"a + add(b * c, [1, 2][0], {\"k\": -1, true: x}[y]) + d", true},
+      {"f()()[1](2, 3); {}; []; {1: 2,}", true},
+      {"let x = if (a < b) { fn(x, y) { (x + y) * 2 }(1, 2) } else { -c };",
+       true},
+      {"return ((a + b) * (c + (d - e)));", true},
+      {"(1 + 2; [1, 2; f(1, 2; {1: 2, 3}; {1 2}; a[1; [1,]; + 5", false},
+      {"let x = -; ) + (; !f(,); {: 1}", false},
+  };
+  for (const auto &[input, valid] : inputs) {
+    Parser recursive{Lexer{input}};
+    auto want{recursive.parse_program()};
+    Parser stacked{Lexer{input}};
+    stacked.explicit_stack = true;
+    auto got{stacked.parse_program()};
+    if (got->statements.size() != want->statements.size() ||
+        stacked.errors != recursive.errors ||
+        valid != recursive.errors.empty() ||
+        (valid && got->to_string() != want->to_string())) {
+      std::cout << "explicit stack parse differs for " << input << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool test_explicit_stack_deep_nesting() {
+  const size_t depth{1'000'000};
+  std::shared_ptr<Program> program{};
+  auto parse{[&program](const std::string &input) -> Expression * {
+    Parser parser{Lexer{input}};
+    parser.explicit_stack = true;
+    program = parser.parse_program();
+    if (!parser.errors.empty() || program->statements.size() != 1) {
+      return nullptr;
+    }
+    return dynamic_cast<ExpressionStatement *>(program->statements[0])
+        ->value;
+  }};
+  // Walks a chain of nodes without recursing
+  auto chain{[](Expression *e, auto next) {
+    size_t length{0};
+    while (e) {
+      e = next(e);
+      ++length;
+    }
+    return length;
+  }};
+
+  auto arrays{parse(std::string(depth, '[') + std::string(depth, ']'))};
+  auto array_depth{chain(arrays, [](Expression *e) -> Expression * {
+    auto array{dynamic_cast<ArrayLiteral *>(e)};
+    return array && !array->elements.empty() ? array->elements[0] : nullptr;
+  })};
+  if (array_depth != depth) {
+    std::cout << "nested arrays: depth " << array_depth << std::endl;
+    return false;
+  }
+
+  auto groups{parse(std::string(depth, '(') + "a" + std::string(depth, ')'))};
+  if (!dynamic_cast<Identifier *>(groups)) {
+    std::cout << "nested parens don't parse to their content" << std::endl;
+    return false;
+  }
+
+  std::string sum{"a"};
+  std::string calls{};
+  for (size_t i = 0; i < depth; ++i) {
+    sum += " + a";
+    calls += "-f(";
+  }
+  calls += "1";
+  calls += std::string(depth, ')');
+  auto sum_length{chain(parse(sum), [](Expression *e) -> Expression * {
+    auto infix{dynamic_cast<InfixExpression *>(e)};
+    return infix ? infix->left : nullptr;
+  })};
+  auto call_depth{chain(parse(calls), [](Expression *e) -> Expression * {
+    auto prefix{dynamic_cast<PrefixExpression *>(e)};
+    auto call{prefix ? dynamic_cast<CallExpression *>(prefix->right) : nullptr};
+    return call ? call->arguments[0] : nullptr;
+  })};
+  if (sum_length != depth + 1 || call_depth != depth + 1) {
+    std::cout << "long chains: " << sum_length << " " << call_depth
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool test_lazy_function_parsing() {
+  std::string input{R"(
+let f = fn(x, y) {
+  let g = fn() { {"k": [x, {}]} };
+  if (x) { g() } else { y }
+};
+let broken = fn() { let = 1; };
+f(1, 2)[0];
+)"};
+  auto tokens{std::make_shared<TokenBuffer>(Lexer{input}.tokenize_all())};
+  Parser eager{tokens};
+  auto want{eager.parse_program()};
+  Parser lazy{tokens};
+  lazy.lazy_functions = true;
+  auto got{lazy.parse_program()};
+  if (!lazy.errors.empty() || eager.errors.empty() ||
+      got->statements.size() != 3 || !lazy.at_end()) {
+    std::cout << "lazy parse didn't skip the broken body" << std::endl;
+    return false;
+  }
+
+  auto literal{[](const Program &program, size_t i) {
+    auto *let{dynamic_cast<LetStatement *>(program.statements[i])};
+    return dynamic_cast<FunctionLiteral *>(let->value);
+  }};
+  auto used{got->arena->bytes_used()};
+  auto *f{literal(*got, 0)};
+  if (!f->body() || got->arena->bytes_used() == used ||
+      f->to_string() != literal(*want, 0)->to_string() ||
+      got->statements[2]->to_string() != want->statements[2]->to_string()) {
+    std::cout << "lazy body differs: " << f->to_string() << std::endl;
+    return false;
+  }
+  auto *broken{literal(*got, 1)};
+  if (broken->body() || broken->body_error() != eager.errors[0]) {
+    std::cout << "lazy body error: " << broken->body_error() << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
 // vim:foldmethod=marker
@@ -0,0 +1,66 @@
+#include "symbol.hpp"
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+namespace {
+struct SymbolTable {
+  std::shared_mutex mutex{};
+  // deque never moves its elements, so the views in `ids` stay valid
+  std::deque<std::string> names{};
+  std::unordered_map<std::string_view, Symbol> ids{};
+};
+
+// Function-local so other globals (the builtins) can intern during static
+// initialization
+SymbolTable &table() {
+  static SymbolTable t{};
+  return t;
+}
+
+Symbol intern_shared(std::string_view name, std::string_view &owned) {
+  auto &t{table()};
+  {
+    std::shared_lock lock{t.mutex};
+    auto it{t.ids.find(name)};
+    if (it != t.ids.end()) {
+      owned = it->first;
+      return it->second;
+    }
+  }
+  std::unique_lock lock{t.mutex};
+  // Another thread may have interned it between the two locks
+  auto it{t.ids.find(name)};
+  if (it != t.ids.end()) {
+    owned = it->first;
+    return it->second;
+  }
+  Symbol id{static_cast<Symbol>(t.names.size())};
+  // Key on the owned copy, `name` may point into a lexer buffer
+  owned = t.names.emplace_back(name);
+  t.ids.emplace(owned, id);
+  return id;
+}
+} // namespace
+
+Symbol intern(std::string_view name) {
+  // Names seen before on this thread skip the lock, so parallel lexer threads
+  // don't contend on the shared table
+  thread_local std::unordered_map<std::string_view, Symbol> cache{};
+  auto cached{cache.find(name)};
+  if (cached != cache.end()) {
+    return cached->second;
+  }
+  std::string_view owned{};
+  auto id{intern_shared(name, owned)};
+  cache.emplace(owned, id);
+  return id;
+}
+
+std::string_view symbol_name(Symbol s) {
+  auto &t{table()};
+  std::shared_lock lock{t.mutex};
+  return t.names[s];
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+typedef uint32_t Symbol;
+
+// Global identifier table filled by the lexer. Names are never freed, so a
+// Symbol and the view returned by symbol_name() stay valid for the whole run.
+// Both functions are safe to call from several threads.
+Symbol intern(std::string_view name);
+std::string_view symbol_name(Symbol);
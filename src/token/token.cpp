@@ -1,102 +1,65 @@
 #include "token.hpp"
 
-std::string Token::to_string() const {
-  using namespace token_types;
-  return std::visit(
-      [](auto &&arg) {
-        using T = std::decay_t<decltype(arg)>;
-        std::string ret_val;
-        if constexpr (std::is_same_v<T, Ident>)
-          ret_val = type_string<T>() + "(" + arg.literal + ")";
-        else if constexpr (std::is_same_v<T, Int>)
-          ret_val = type_string<T>() + "(" + std::to_string(arg.value) + ")";
-        else if constexpr (std::is_same_v<T, String>)
-          ret_val = type_string<T>() + "(" + arg.value + ")";
-        else
-          ret_val = type_string<T>();
-        return ret_val;
-      },
-      value);
+namespace {
+#define TOKEN_NAME(CLASS, NAME, LITERAL) NAME,
+constexpr std::string_view type_names[]{TOKEN_KINDS(TOKEN_NAME)};
+#undef TOKEN_NAME
+
+#define TOKEN_LITERAL(CLASS, NAME, LITERAL) LITERAL,
+constexpr std::string_view literals[]{TOKEN_KINDS(TOKEN_LITERAL)};
+#undef TOKEN_LITERAL
+} // namespace
+
+std::string_view type_name(TokenKind kind) {
+  return type_names[kind_index(kind)];
+}
+
+std::string type_to_string(TokenKind kind) { return Token{kind}.to_string(); }
+
+std::string literal_string(TokenKind kind) {
+  return std::string{literals[kind_index(kind)]};
 }
 
-std::string Token::literal() const { return literal_string(value); }
+Token Token::ident(Symbol symbol) {
+  Token tok{TokenKind::Ident};
+  tok.sym = symbol;
+  return tok;
+}
+
+Token Token::number(IntType value) {
+  Token tok{TokenKind::Int};
+  tok.integer = value;
+  return tok;
+}
 
-std::string type_to_string(token_types::TokenVariant v) {
-  return Token{v}.to_string();
-};
+Token Token::string(std::string_view value) {
+  Token tok{TokenKind::String};
+  tok.text = value.data();
+  tok.length = value.length();
+  return tok;
+}
 
-std::string literal_string(token_types::TokenVariant v) {
-  return std::visit(
-      [](auto &&arg) {
-        using namespace token_types;
-        using T = std::decay_t<decltype(arg)>;
-        std::string ret_val;
-        if constexpr (std::is_same_v<T, Illegal>)
-          ret_val = "ILLEGAL";
-        else if constexpr (std::is_same_v<T, Eof>)
-          ret_val = "EOF";
-        else if constexpr (std::is_same_v<T, Ident>)
-          ret_val = arg.literal;
-        else if constexpr (std::is_same_v<T, Int>)
-          ret_val = arg.value;
-        else if constexpr (std::is_same_v<T, String>)
-          ret_val = arg.value;
-        else if constexpr (std::is_same_v<T, Assign>)
-          ret_val = "=";
-        else if constexpr (std::is_same_v<T, Plus>)
-          ret_val = "+";
-        else if constexpr (std::is_same_v<T, Minus>)
-          ret_val = "-";
-        else if constexpr (std::is_same_v<T, Bang>)
-          ret_val = "!";
-        else if constexpr (std::is_same_v<T, Slash>)
-          ret_val = "/";
-        else if constexpr (std::is_same_v<T, Asterisk>)
-          ret_val = "*";
-        else if constexpr (std::is_same_v<T, LT>)
-          ret_val = "<";
-        else if constexpr (std::is_same_v<T, GT>)
-          ret_val = ">";
-        else if constexpr (std::is_same_v<T, Eq>)
-          ret_val = "==";
-        else if constexpr (std::is_same_v<T, NotEq>)
-          ret_val = "!=";
-        else if constexpr (std::is_same_v<T, Comma>)
-          ret_val = ",";
-        else if constexpr (std::is_same_v<T, Semicolon>)
-          ret_val = ";";
-        else if constexpr (std::is_same_v<T, Colon>)
-          ret_val = ":";
-        else if constexpr (std::is_same_v<T, LParen>)
-          ret_val = "(";
-        else if constexpr (std::is_same_v<T, RParen>)
-          ret_val = ")";
-        else if constexpr (std::is_same_v<T, LSquirly>)
-          ret_val = "{";
-        else if constexpr (std::is_same_v<T, RSquirly>)
-          ret_val = "}";
-        else if constexpr (std::is_same_v<T, LSquarely>)
-          ret_val = "[";
-        else if constexpr (std::is_same_v<T, RSquarely>)
-          ret_val = "]";
-        else if constexpr (std::is_same_v<T, Function>)
-          ret_val = "fn";
-        else if constexpr (std::is_same_v<T, Let>)
-          ret_val = "let";
-        else if constexpr (std::is_same_v<T, True>)
-          ret_val = "true";
-        else if constexpr (std::is_same_v<T, False>)
-          ret_val = "false";
-        else if constexpr (std::is_same_v<T, If>)
-          ret_val = "if";
-        else if constexpr (std::is_same_v<T, Else>)
-          ret_val = "else";
-        else if constexpr (std::is_same_v<T, Return>)
-          ret_val = "return";
-        else
-          static_assert(always_false_v<T>, "non-exhaustive visitor!");
+std::string Token::to_string() const {
+  auto name{std::string{type_name(kind)}};
+  switch (kind) {
+  case TokenKind::Ident:
+  case TokenKind::Int:
+  case TokenKind::String:
+    return name + "(" + literal() + ")";
+  default:
+    return name;
+  }
+}
 
-        return ret_val;
-      },
-      v);
+std::string Token::literal() const {
+  switch (kind) {
+  case TokenKind::Ident:
+    return std::string{symbol_name(sym)};
+  case TokenKind::Int:
+    return std::to_string(integer);
+  case TokenKind::String:
+    return std::string{string_value()};
+  default:
+    return literal_string(kind);
+  }
 }
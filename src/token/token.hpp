@@ -1,170 +1,126 @@
 #pragma once
+#include "symbol.hpp"
+#include <cstdint>
 #include <string>
-#include <variant>
+#include <string_view>
+#include <type_traits>
 
 typedef int64_t IntType;
 
 // I am so sorry, can't resist my C ways
-#define TOKEN_TYPE(CLASS)                                                      \
-  struct CLASS {                                                               \
-    bool operator==(const CLASS &) const { return true; }                      \
-  }
+// X(kind, type name, literal)
+#define TOKEN_KINDS(X)                                                         \
+  X(Illegal, "ILLEGAL", "ILLEGAL")                                             \
+  X(Eof, "EOF", "EOF")                                                         \
+  /* Identifiers + Literals */                                                 \
+  X(Ident, "IDENT", "")                                                        \
+  X(Int, "INT", "")                                                            \
+  X(String, "STRING", "")                                                      \
+  /* Operators */                                                              \
+  X(Assign, "ASSIGN", "=")                                                     \
+  X(Plus, "PLUS", "+")                                                         \
+  X(Minus, "MINUS", "-")                                                       \
+  X(Bang, "BANG", "!")                                                         \
+  X(Asterisk, "ASTERISK", "*")                                                 \
+  X(Slash, "SLASH", "/")                                                       \
+  X(LT, "LT", "<")                                                             \
+  X(GT, "GT", ">")                                                             \
+  X(Eq, "EQ", "==")                                                            \
+  X(NotEq, "NOT_EQ", "!=")                                                     \
+  /* Delimiters */                                                             \
+  X(Comma, "COMMA", ",")                                                       \
+  X(Semicolon, "SEMICOLON", ";")                                               \
+  X(Colon, "COLON", ":")                                                       \
+  X(LParen, "LPAREN", "(")                                                     \
+  X(RParen, "RPAREN", ")")                                                     \
+  X(LSquirly, "LSQUIRLY", "{")                                                 \
+  X(RSquirly, "RSQUIRLY", "}")                                                 \
+  X(LSquarely, "LSQUARELY", "[")                                               \
+  X(RSquarely, "RSQUARELY", "]")                                               \
+  /* Keywords */                                                               \
+  X(Function, "FUNCTION", "fn")                                                \
+  X(Let, "LET", "let")                                                         \
+  X(True, "TRUE", "true")                                                      \
+  X(False, "FALSE", "false")                                                   \
+  X(If, "IF", "if")                                                            \
+  X(Else, "ELSE", "else")                                                      \
+  X(Return, "RETURN", "return")
+
+#define TOKEN_KIND_ENUM(CLASS, NAME, LITERAL) CLASS,
+enum class TokenKind : uint8_t { TOKEN_KINDS(TOKEN_KIND_ENUM) };
+#undef TOKEN_KIND_ENUM
+
+#define TOKEN_KIND_ONE(CLASS, NAME, LITERAL) +1
+inline constexpr size_t TOKEN_KIND_COUNT{0 TOKEN_KINDS(TOKEN_KIND_ONE)};
+#undef TOKEN_KIND_ONE
+
+// For tables indexed by token kind
+constexpr size_t kind_index(TokenKind kind) {
+  return static_cast<size_t>(kind);
+}
 
+// One empty tag per kind, for templates like Token::is_type<Plus>() and
+// expect_peek<RParen>(). Tags convert to their TokenKind.
 namespace token_types {
-TOKEN_TYPE(Illegal);
-TOKEN_TYPE(Eof);
-
-// Identifiers + Literals
-struct Ident {
-  std::string literal;
-  bool operator==(const Ident &) const { return true; }
-};
-struct Int {
-  IntType value;
-  bool operator==(const Int &) const { return true; }
-};
-struct String {
-  std::string value;
-  bool operator==(const String &) const { return true; }
+#define TOKEN_TYPE(CLASS, NAME, LITERAL)                                       \
+  struct CLASS {                                                               \
+    static constexpr TokenKind kind{TokenKind::CLASS};                         \
+    constexpr operator TokenKind() const { return kind; }                      \
+  };
+TOKEN_KINDS(TOKEN_TYPE)
+#undef TOKEN_TYPE
+
+struct Keyword {
+  std::string_view word;
+  TokenKind kind;
 };
 
-// Operators
-TOKEN_TYPE(Assign);
-TOKEN_TYPE(Plus);
-TOKEN_TYPE(Minus);
-TOKEN_TYPE(Bang);
-TOKEN_TYPE(Asterisk);
-TOKEN_TYPE(Slash);
-
-TOKEN_TYPE(LT);
-TOKEN_TYPE(GT);
-TOKEN_TYPE(Eq);
-TOKEN_TYPE(NotEq);
-
-// Delimiters
-TOKEN_TYPE(Comma);
-TOKEN_TYPE(Semicolon);
-TOKEN_TYPE(Colon);
-
-TOKEN_TYPE(LParen);
-TOKEN_TYPE(RParen);
-TOKEN_TYPE(LSquirly);
-TOKEN_TYPE(RSquirly);
-TOKEN_TYPE(LSquarely);
-TOKEN_TYPE(RSquarely);
-
-// Keywords
-TOKEN_TYPE(Function);
-TOKEN_TYPE(Let);
-TOKEN_TYPE(True);
-TOKEN_TYPE(False);
-TOKEN_TYPE(If);
-TOKEN_TYPE(Else);
-TOKEN_TYPE(Return);
+// The lexer builds its keyword hash table from this list at compile time
+inline constexpr Keyword keywords[]{
+    {"fn", Function{}}, {"let", Let{}},   {"true", True{}},
+    {"false", False{}}, {"if", If{}},     {"else", Else{}},
+    {"return", Return{}},
+};
+} // namespace token_types
 
-using TokenVariant =
-    std::variant<Illegal, Eof, Ident, Int, String, Assign, Plus, Minus, Bang,
-                 Asterisk, Slash, LT, GT, Eq, NotEq, Comma, Semicolon, Colon,
-                 LParen, RParen, LSquirly, RSquirly, LSquarely, RSquarely,
-                 Function, Let, True, False, If, Else, Return>;
+// "PLUS", "IDENT", ...
+std::string_view type_name(TokenKind);
+std::string type_to_string(TokenKind);
+// "+", "fn", ... Empty for kinds whose literal lives in the payload.
+std::string literal_string(TokenKind);
 
-template <typename TokenType> bool is_type(TokenVariant t) {
-  return std::visit(
-      [](auto &&arg) {
-        using T = std::decay_t<decltype(arg)>;
-        if constexpr (std::is_same_v<T, TokenType>) {
-          return true;
-        }
-        return false;
-      },
-      t);
+template <typename T> std::string type_string() {
+  return std::string{type_name(T::kind)};
 }
-} // namespace token_types
 
-std::string type_to_string(token_types::TokenVariant);
+// 16 bytes, trivially copyable. Identifiers are interned, String payloads
+// point into the lexer's source buffer.
+class Token {
+public:
+  constexpr Token() : Token(TokenKind::Eof) {}
+  constexpr Token(TokenKind kind) : kind{kind}, length{0}, integer{0} {}
+  static Token ident(Symbol);
+  static Token number(IntType);
+  static Token string(std::string_view);
 
-struct Token {
-  Token() : value{token_types::Eof{}} {}
-  token_types::TokenVariant value;
-  Token(token_types::TokenVariant v) : value{v} {}
-  std::string to_string() const;
   template <typename TokenType> bool is_type() const {
-    return token_types::is_type<TokenType>(value);
+    return kind == TokenType::kind;
   }
+  Symbol symbol() const { return sym; }
+  IntType int_value() const { return integer; }
+  std::string_view string_value() const { return {text, length}; }
+  std::string to_string() const;
   std::string literal() const;
-};
 
-template <class> inline constexpr bool always_false_v = false;
+  TokenKind kind;
 
-std::string literal_string(token_types::TokenVariant v);
-
-template <typename T> std::string type_string() {
-  using namespace token_types;
-  std::string ret_val;
-  if constexpr (std::is_same_v<T, Illegal>)
-    ret_val = "ILLEGAL";
-  else if constexpr (std::is_same_v<T, Eof>)
-    ret_val = "EOF";
-  else if constexpr (std::is_same_v<T, Ident>)
-    ret_val = "IDENT";
-  else if constexpr (std::is_same_v<T, Int>)
-    ret_val = "INT";
-  else if constexpr (std::is_same_v<T, String>)
-    ret_val = "STRING";
-  else if constexpr (std::is_same_v<T, Assign>)
-    ret_val = "ASSIGN";
-  else if constexpr (std::is_same_v<T, Plus>)
-    ret_val = "PLUS";
-  else if constexpr (std::is_same_v<T, Minus>)
-    ret_val = "MINUS";
-  else if constexpr (std::is_same_v<T, Bang>)
-    ret_val = "BANG";
-  else if constexpr (std::is_same_v<T, Slash>)
-    ret_val = "SLASH";
-  else if constexpr (std::is_same_v<T, Asterisk>)
-    ret_val = "ASTERISK";
-  else if constexpr (std::is_same_v<T, LT>)
-    ret_val = "LT";
-  else if constexpr (std::is_same_v<T, GT>)
-    ret_val = "GT";
-  else if constexpr (std::is_same_v<T, Eq>)
-    ret_val = "EQ";
-  else if constexpr (std::is_same_v<T, NotEq>)
-    ret_val = "NOT_EQ";
-  else if constexpr (std::is_same_v<T, Comma>)
-    ret_val = "COMMA";
-  else if constexpr (std::is_same_v<T, Semicolon>)
-    ret_val = "SEMICOLON";
-  else if constexpr (std::is_same_v<T, Colon>)
-    ret_val = "COLON";
-  else if constexpr (std::is_same_v<T, LParen>)
-    ret_val = "LPAREN";
-  else if constexpr (std::is_same_v<T, RParen>)
-    ret_val = "RPAREN";
-  else if constexpr (std::is_same_v<T, LSquirly>)
-    ret_val = "LSQUIRLY";
-  else if constexpr (std::is_same_v<T, RSquirly>)
-    ret_val = "RSQUIRLY";
-  else if constexpr (std::is_same_v<T, LSquarely>)
-    ret_val = "LSQUARELY";
-  else if constexpr (std::is_same_v<T, RSquarely>)
-    ret_val = "RSQUARELY";
-  else if constexpr (std::is_same_v<T, Function>)
-    ret_val = "FUNCTION";
-  else if constexpr (std::is_same_v<T, Let>)
-    ret_val = "LET";
-  else if constexpr (std::is_same_v<T, True>)
-    ret_val = "TRUE";
-  else if constexpr (std::is_same_v<T, False>)
-    ret_val = "FALSE";
-  else if constexpr (std::is_same_v<T, If>)
-    ret_val = "IF";
-  else if constexpr (std::is_same_v<T, Else>)
-    ret_val = "ELSE";
-  else if constexpr (std::is_same_v<T, Return>)
-    ret_val = "RETURN";
-  else
-    static_assert(always_false_v<T>, "non-exhaustive visitor!");
-
-  return ret_val;
-}
+private:
+  uint32_t length;
+  union {
+    Symbol sym;
+    IntType integer;
+    const char *text;
+  };
+};
+static_assert(std::is_trivially_copyable_v<Token>);
+static_assert(sizeof(Token) == 16);